@@ -1,25 +1,21 @@
 
-use ivy_vm::{book::{Book, Def, Operation}, node::Node, run_vm};
-
-unsafe fn print_f64s(n_ins: u64, ins: *const Node) -> Node {
-    // TODO: output might get broken up if used in a multithreaded way
-    print!("f64 debug: ");
-    for i in 0..n_ins {
-        let node = ins.wrapping_add(i as usize).as_ref().unwrap().copy();
-        print!("{} ", node.as_f64().unwrap()); 
-    }
-    println!();
-    Node::era()
-}
+use ivy_vm::{book::{Book, DefID, Operation}, run_vm, VmConfig};
 
-fn pow2_sum(def: &mut Def, depth: u64) -> Node {
+// Builds defs summing 2^depth ones, each level calling the one below twice.
+// Returns the def of the top level.
+fn pow2_sum(book: &mut Book, depth: u64) -> DefID {
+    let id = book.add_def();
     if depth == 0 {
-        1.0.into()
+        book.get_def(id).set_out(1.0.into());
     } else {
-        let a = pow2_sum(def, depth - 1);
-        let b = pow2_sum(def, depth - 1);
-        def.add_operation(Operation::Add, vec![a, b])
+        let half = pow2_sum(book, depth - 1);
+        let mut def = book.get_def(id);
+        let a = def.call(half);
+        let b = def.call(half);
+        let sum = def.add_operation(Operation::Add, vec![a, b]);
+        def.set_out(sum);
     }
+    id
 }
 
 fn main() {
@@ -27,15 +23,32 @@ fn main() {
     let mut book = Book::new();
     let main = book.add_def();
 
-    let mut main = book.get_def(main);
+    // The main def is the top level of a depth 24 sum
+    let half = pow2_sum(&mut book, 23);
 
-    let sum = pow2_sum(&mut main, 24);
-    let call = main.add_operation(
-        Operation::Native(print_f64s),
-        vec![sum] 
-    );
-    main.set_out(call);
+    let mut main = book.get_def(main);
+    let a = main.call(half);
+    let b = main.call(half);
+    let sum = main.add_operation(Operation::Add, vec![a, b]);
+    main.set_out(sum);
+
+    // With --optimize the sum is folded down before the run
+    if std::env::args().any(|arg| arg == "--optimize") {
+        let opt = book.optimize();
+        println!("OPTIMIZED: {} calls inlined, {} operations folded, redexes {} -> {}", opt.calls_inlined, opt.operations_folded, opt.redexes_before, opt.redexes_after);
+    }
 
-    run_vm(book);
+    let out = match run_vm(book, &VmConfig::default()) {
+        Ok(out) => out,
+        Err(err) => {
+            eprintln!("RUN FAILED: {}", err);
+            std::process::exit(1);
+        }
+    };
+    println!("RESULT: {:?}", out.output);
+    let stats = out.stats;
+    println!("INTERACTIONS: {}", stats.interactions);
+    println!("TIME TAKEN: {}", stats.time_taken);
+    println!("MIPS: {}", stats.mips());
 
 }
@@ -0,0 +1,65 @@
+
+use ivy_vm::{bench_instance, book::{Book, Def, Operation}, node::Node};
+
+// Operation tree summing 2^depth ones
+fn sum_tree(def: &mut Def, depth: u64) -> Node {
+    if depth == 0 {
+        1.0.into()
+    } else {
+        let a = sum_tree(def, depth - 1);
+        let b = sum_tree(def, depth - 1);
+        def.add_operation(Operation::Add, vec![a, b])
+    }
+}
+
+// Binary CON tree with 2^depth leaves, every leaf wired to a DUP leaf of a mirrored tree
+fn con_tree(def: &mut Def, depth: u64, leaves: &mut Vec<Node>) -> Node {
+    if depth == 0 {
+        let (a, b) = def.add_var();
+        leaves.push(b);
+        a
+    } else {
+        let l = con_tree(def, depth - 1, leaves);
+        let r = con_tree(def, depth - 1, leaves);
+        def.con(&[l, r])
+    }
+}
+
+fn dup_tree(def: &mut Def, leaves: &mut std::vec::IntoIter<Node>, depth: u64) -> Node {
+    if depth == 0 {
+        leaves.next().unwrap()
+    } else {
+        let l = dup_tree(def, leaves, depth - 1);
+        let r = dup_tree(def, leaves, depth - 1);
+        def.dup(&[l, r])
+    }
+}
+
+fn bench(name: &str, count: u64, build: impl FnOnce(&mut Def)) {
+    let mut book = Book::new();
+    let id = book.add_def();
+    build(&mut book.get_def(id));
+    let rate = bench_instance(&mut book, id, count);
+    println!("{:<24} {:>12.0} instances/s", name, rate);
+}
+
+fn main() {
+    bench("sum_tree(8)", 20000, |def| {
+        let out = sum_tree(def, 8);
+        def.set_out(out);
+    });
+    bench("con_dup_trees(8)", 20000, |def| {
+        let mut leaves = Vec::new();
+        let con = con_tree(def, 8, &mut leaves);
+        let dup = dup_tree(def, &mut leaves.into_iter(), 8);
+        def.add_redex(con, dup);
+    });
+    bench("con_tree_out(12)", 2000, |def| {
+        let mut leaves = Vec::new();
+        let con = con_tree(def, 12, &mut leaves);
+        for leaf in leaves {
+            def.add_redex(leaf, Node::era());
+        }
+        def.set_out(con);
+    });
+}
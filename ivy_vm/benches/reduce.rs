@@ -0,0 +1,185 @@
+use ivy_vm::{book::{Book, Def, DefID, Operation}, node::Node, run_vm, VmConfig};
+
+// Defs summing 2^depth ones, each level calling the one below twice
+fn pow2_sum(book: &mut Book, depth: u64) -> DefID {
+    let id = book.add_def();
+    if depth == 0 {
+        book.get_def(id).set_out(1.0.into());
+    } else {
+        let half = pow2_sum(book, depth - 1);
+        let mut def = book.get_def(id);
+        let a = def.call(half);
+        let b = def.call(half);
+        let sum = def.add_operation(Operation::Add, vec![a, b]);
+        def.set_out(sum);
+    }
+    id
+}
+
+// Defs summing width^depth ones with operations of width inputs
+fn wide_sum(book: &mut Book, width: u64, depth: u64) -> DefID {
+    let id = book.add_def();
+    if depth == 0 {
+        book.get_def(id).set_out(1.0.into());
+    } else {
+        let part = wide_sum(book, width, depth - 1);
+        let mut def = book.get_def(id);
+        let ins = (0..width).map(|_| def.call(part)).collect();
+        let sum = def.add_operation(Operation::Add, ins);
+        def.set_out(sum);
+    }
+    id
+}
+
+// SUM = λn. n == 0 ? 0 : n + SUM(n - 1), as two mutually recursive defs
+fn rec_sum(book: &mut Book) -> DefID {
+    let sum = book.add_def();
+    let rec = book.add_def();
+    {
+        let mut def = book.get_def(sum);
+        let (n, n_) = def.add_var();
+        let (ret, ret_) = def.add_var();
+        let (n1, n1_) = def.add_var();
+        let (n2, n2_) = def.add_var();
+        let dup = def.dup(&[n1, n2]);
+        def.add_redex(n_, dup);
+        let zero = def.con(&[Node::era(), 0.0.into()]);
+        let step = def.call(rec);
+        let branch = def.switch(n1_, vec![zero, step]);
+        let app = def.con(&[n2_, ret_]);
+        def.add_redex(branch, app);
+        let out = def.con(&[n, ret]);
+        def.set_out(out);
+    }
+    {
+        let mut def = book.get_def(rec);
+        let (m, m_) = def.add_var();
+        let (res, res_) = def.add_var();
+        let (m1, m1_) = def.add_var();
+        let (m2, m2_) = def.add_var();
+        let dup = def.dup(&[m1, m2]);
+        def.add_redex(m_, dup);
+        let dec = def.add_operation(Operation::Add, vec![m1_, (-1.0).into()]);
+        let (r, r_) = def.add_var();
+        let app = def.con(&[dec, r]);
+        let call = def.call(sum);
+        def.add_redex(call, app);
+        let total = def.add_operation(Operation::Add, vec![m2_, r_]);
+        def.add_redex(res_, total);
+        let out = def.con(&[m, res]);
+        def.set_out(out);
+    }
+    sum
+}
+
+// Binary CON tree with 2^depth var leaves
+fn con_tree(def: &mut Def, depth: u64, leaves: &mut Vec<Node>) -> Node {
+    if depth == 0 {
+        let (a, b) = def.add_var();
+        leaves.push(b);
+        a
+    } else {
+        let l = con_tree(def, depth - 1, leaves);
+        let r = con_tree(def, depth - 1, leaves);
+        def.con(&[l, r])
+    }
+}
+
+fn dup_tree(def: &mut Def, depth: u64, leaves: &mut Vec<Node>) -> Node {
+    if depth == 0 {
+        let (a, b) = def.add_var();
+        leaves.push(b);
+        a
+    } else {
+        let l = dup_tree(def, depth - 1, leaves);
+        let r = dup_tree(def, depth - 1, leaves);
+        def.dup(&[l, r])
+    }
+}
+
+fn bench(name: &str, config: &VmConfig, build: impl FnOnce(&mut Book, DefID)) {
+    let mut book = Book::new();
+    let main = book.add_def();
+    build(&mut book, main);
+    let stats = run_vm(book, config).expect("run failed").stats;
+    println!(
+        "{:<20} {:>3} threads {:>12} interactions {:>10.3}s {:>10.2} MIPS {:>14.0} per thread {:>10.1} MiB",
+        name,
+        config.threads,
+        stats.interactions,
+        stats.time_taken,
+        stats.mips(),
+        stats.interactions_per_thread(),
+        stats.peak_memory as f64 / (1 << 20) as f64
+    );
+}
+
+// Thread counts to run at can be given as arguments, `cargo bench --bench reduce -- 1 2 4`.
+// Without any every core is used.
+fn main() {
+    let threads: Vec<u32> = std::env::args().skip(1)
+        .filter(|arg| !arg.starts_with('-'))
+        .map(|arg| arg.parse().expect("thread counts must be numbers"))
+        .collect();
+    if threads.is_empty() {
+        run_all(&VmConfig::default());
+    }
+    for threads in threads {
+        run_all(&VmConfig { threads, ..VmConfig::default() });
+    }
+}
+
+fn run_all(config: &VmConfig) {
+    bench("pow2_sum(20)", config, |book, main| {
+        let sum = pow2_sum(book, 20);
+        let mut def = book.get_def(main);
+        let call = def.call(sum);
+        let out = def.add_operation(Operation::Add, vec![call]);
+        def.set_out(out);
+    });
+    // Every CON meets every DUP, the two trees commute all the way down
+    bench("con_dup_comm(9)", config, |book, main| {
+        let mut def = book.get_def(main);
+        let mut con_leaves = Vec::new();
+        let mut dup_leaves = Vec::new();
+        let con = con_tree(&mut def, 9, &mut con_leaves);
+        let dup = dup_tree(&mut def, 9, &mut dup_leaves);
+        def.add_redex(con, dup);
+        for leaf in con_leaves.into_iter().chain(dup_leaves) {
+            def.add_redex(leaf, Node::era());
+        }
+    });
+    bench("erase_tree(18)", config, |book, main| {
+        let mut def = book.get_def(main);
+        let mut leaves = Vec::new();
+        let con = con_tree(&mut def, 18, &mut leaves);
+        for leaf in leaves {
+            def.add_redex(leaf, Node::era());
+        }
+        def.add_redex(con, Node::era());
+    });
+    bench("wide_sum(16, 5)", config, |book, main| {
+        let sum = wide_sum(book, 16, 5);
+        let mut def = book.get_def(main);
+        let call = def.call(sum);
+        let out = def.add_operation(Operation::Add, vec![call]);
+        def.set_out(out);
+    });
+    // Three input operations, too wide for the batched sweeps
+    bench("wide_sum(3, 13)", config, |book, main| {
+        let sum = wide_sum(book, 3, 13);
+        let mut def = book.get_def(main);
+        let call = def.call(sum);
+        let out = def.add_operation(Operation::Add, vec![call]);
+        def.set_out(out);
+    });
+    bench("rec_sum(100000)", config, |book, main| {
+        let sum = rec_sum(book);
+        let mut def = book.get_def(main);
+        let (res, res_) = def.add_var();
+        let app = def.con(&[100000.0.into(), res]);
+        let call = def.call(sum);
+        def.add_redex(call, app);
+        def.set_out(res_);
+    });
+}
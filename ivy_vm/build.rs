@@ -3,10 +3,18 @@ fn main() {
     println!("cargo:rerun-if-changed=src/vm/*.c");
     println!("cargo:rerun-if-changed=src/vm/*.h");
 
-    let _ = cc::Build::new()
+    let mut build = cc::Build::new();
+    if std::env::var_os("CARGO_FEATURE_STATS").is_some() {
+        build.define("VM_STATS", None);
+    }
+
+    let _ = build
         .file("src/vm/vm.c") 
+        .file("src/vm/heap.c") 
         .file("src/vm/node.c") 
         .file("src/vm/book.c") 
+        .file("src/vm/book_file.c") 
+        .file("src/vm/optimize.c") 
         .file("src/vm/operation.c") 
         .file("src/vm/run.c") 
         .try_compile("vm");
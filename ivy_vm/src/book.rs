@@ -1,19 +1,39 @@
 
-use std::ffi::c_void;
+use std::{ffi::{c_char, c_void, CString}, io, marker::PhantomData, os::unix::ffi::OsStrExt, path::Path};
 use crate::node::{Aux, Node};
 
 pub struct Book {
-    pub(crate) book: *mut c_void,
-    curr_def: u64
+    pub(crate) book: *mut c_void
 }
 
 pub struct Def<'a> {
-    book: &'a mut Book,
-    def: *mut c_void
+    def: *mut c_void,
+    _book: PhantomData<&'a mut Book>
 }
 
+/// ADD, MUL, MIN and MAX reduce over all inputs, SUB and DIV fold from the left.
+/// Comparisons produce 1.0 or 0.0 and FMA computes `ins[0] * ins[1] + ins[2]`.
+/// The bitwise operations act on symbols (see `Node::sym`).
+/// SUB, DIV and the bitwise operations need at least one input, comparisons and shifts two.
 pub enum Operation {
     Add,
+    Sub,
+    Mul,
+    Div,
+    Min,
+    Max,
+    Eq,
+    Ne,
+    Lt,
+    Le,
+    Gt,
+    Ge,
+    Fma,
+    And,
+    Or,
+    Xor,
+    Shl,
+    Shr,
     Native(unsafe fn(u64, *const Node) -> Node)
 }
 
@@ -22,6 +42,23 @@ impl Operation {
     fn to_op_code(&self) -> u64 {
         match self {
             Operation::Add => 0,
+            Operation::Sub => 1,
+            Operation::Mul => 2,
+            Operation::Div => 3,
+            Operation::Min => 4,
+            Operation::Max => 5,
+            Operation::Eq  => 6,
+            Operation::Ne  => 7,
+            Operation::Lt  => 8,
+            Operation::Le  => 9,
+            Operation::Gt  => 10,
+            Operation::Ge  => 11,
+            Operation::Fma => 12,
+            Operation::And => 13,
+            Operation::Or  => 14,
+            Operation::Xor => 15,
+            Operation::Shl => 16,
+            Operation::Shr => 17,
             Operation::Native(func) => {
                 let fn_addr = *func as *const unsafe fn(u64, *const Node) -> Node as u64;
                 (1u64 << 63) | fn_addr
@@ -29,22 +66,60 @@ impl Operation {
         }
     }
 
+    fn min_inputs(&self) -> usize {
+        match self {
+            Operation::Sub | Operation::Div | Operation::And | Operation::Or | Operation::Xor => 1,
+            Operation::Eq | Operation::Ne | Operation::Lt | Operation::Le | Operation::Gt | Operation::Ge
+                | Operation::Shl | Operation::Shr => 2,
+            _ => 0
+        }
+    }
+
 }
 
-pub struct DefID(u64);
+// Redexes handed to the VM per call by `Def::add_redexes`
+const REDEX_BATCH: usize = 512;
+
+/// What `Book::optimize` did, summed over every def of the book.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct OptimizeStats {
+    /// Calls to defs that reduced to a number or an eraser, replaced by it.
+    pub calls_inlined: u64,
+    /// Operations computed because all of their inputs were numbers.
+    pub operations_folded: u64,
+    pub redexes_before: u64,
+    pub redexes_after: u64,
+    /// Aux nodes, including blocks nothing pointed at.
+    pub aux_before: u64,
+    pub aux_after: u64,
+    pub vars_before: u64,
+    pub vars_after: u64
+}
+
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub struct DefID(pub(crate) u64);
 
 extern "C" {
     fn create_book() -> *mut c_void;
     fn destroy_book(book: *mut c_void);
 
-    fn add_aux(book: *mut c_void, size: u32, nodes: *const u64) -> u64;
+    fn add_def(book: *mut c_void) -> u64;
     fn get_def(book: *mut c_void, id: u64) -> *mut c_void;
 
     fn def_set_out(def: *mut c_void, node: u64);
     fn def_add_var(def: *mut c_void) -> u64;
+    fn def_add_aux(def: *mut c_void, size: u32, nodes: *const u64) -> u64;
+    fn def_add_aux_blocks(def: *mut c_void, size: u32, n: u64, nodes: *const u64) -> u64;
     fn def_add_redex(def: *mut c_void, a: u64, b: u64);
+    fn def_add_redexes(def: *mut c_void, pairs: *const u64, n: u64);
     fn def_add_oper(def: *mut c_void, op: u64, ins: u32) -> u64;
 
+    fn book_optimize(book: *mut c_void, stats: *mut OptimizeStats);
+
+    fn book_save(book: *mut c_void, path: *const c_char) -> u32;
+    fn book_load(path: *const c_char, out: *mut *mut c_void) -> u32;
+
 }
 
 impl Book {
@@ -52,40 +127,72 @@ impl Book {
     pub fn new() -> Self {
         let book = unsafe { create_book() };
         Self {
-            book,
-            curr_def: 0
+            book
         }
     }
 
     pub fn add_def(&mut self) -> DefID {
-        self.curr_def += 1; 
-        DefID(self.curr_def - 1)
+        DefID(unsafe { add_def(self.book) })
     }
 
     pub fn get_def<'a>(&'a mut self, id: DefID) -> Def<'a> {
         let def = unsafe { get_def(self.book, id.0) }; 
         Def {
-            book: self,
-            def
+            def,
+            _book: PhantomData
         } 
     }
 
-    pub fn add_aux(&mut self, nodes: &[Node]) -> Aux {
-        assert!(nodes.len() <= 256, "aux can have at most 256 nodes.");
-        let size = nodes.len() as u32;
-        unsafe { Aux(add_aux(self.book, size, nodes.as_ptr() as *const u64)) }
+    /// Reduces each def as far as it can be without running it, so instances of it start out smaller.
+    /// Operations on numbers are computed, redexes that don't depend on anything outside the def are reduced
+    /// and calls to defs that reduce to a number are replaced by it. Native operations are never folded.
+    pub fn optimize(&mut self) -> OptimizeStats {
+        let mut stats = OptimizeStats::default();
+        unsafe {
+            book_optimize(self.book, &mut stats);
+        }
+        stats
     }
 
-    pub fn con(&mut self, nodes: &[Node]) -> Node {
-        Node::con(self.add_aux(nodes))
+    /// Writes the book to a file `load_mmap` can map back in, compiled and ready to run.
+    /// The file is only meant to be read on the kind of machine that wrote it.
+    /// Books with native operations can't be saved, function pointers don't carry over to another process.
+    pub fn save<P: AsRef<Path>>(&mut self, path: P) -> io::Result<()> {
+        let path = path_to_cstring(path.as_ref())?;
+        book_file_result(unsafe { book_save(self.book, path.as_ptr()) })
     }
 
-    pub fn dup(&mut self, nodes: &[Node]) -> Node {
-        Node::dup(self.add_aux(nodes))
+    /// Maps a book written by `save` without reading or copying its defs.
+    /// A def is only copied out of the file once it's changed.
+    pub fn load_mmap<P: AsRef<Path>>(path: P) -> io::Result<Self> {
+        let path = path_to_cstring(path.as_ref())?;
+        let mut book = std::ptr::null_mut();
+        book_file_result(unsafe { book_load(path.as_ptr(), &mut book) })?;
+        Ok(Self { book })
     }
 
 }
 
+fn path_to_cstring(path: &Path) -> io::Result<CString> {
+    CString::new(path.as_os_str().as_bytes()).map_err(|_| io::Error::new(io::ErrorKind::InvalidInput, "path contains a nul byte"))
+}
+
+// Results of book_save and book_load
+const BOOK_FILE_OK: u32 = 0;
+const BOOK_FILE_IO: u32 = 1;
+const BOOK_FILE_INVALID: u32 = 2;
+const BOOK_FILE_NATIVE: u32 = 3;
+
+fn book_file_result(result: u32) -> io::Result<()> {
+    match result {
+        BOOK_FILE_OK => Ok(()),
+        BOOK_FILE_IO => Err(io::Error::last_os_error()),
+        BOOK_FILE_INVALID => Err(io::Error::new(io::ErrorKind::InvalidData, "not a book file of this version")),
+        BOOK_FILE_NATIVE => Err(io::Error::new(io::ErrorKind::InvalidInput, "books with native operations can't be saved")),
+        _ => Err(io::Error::new(io::ErrorKind::Other, "the book ran out of space while being built"))
+    }
+}
+
 impl Drop for Book {
     
     fn drop(&mut self) {
@@ -110,25 +217,78 @@ impl<'a> Def<'a> {
         }
     } 
 
+    /// Adds all the redexes with a single call into the VM.
+    pub fn add_redexes(&mut self, redexes: &[(Node, Node)]) {
+        // Tuples have no fixed layout, so they're copied into buffers laid out like the VM's pairs
+        let mut buf = [0u64; 2 * REDEX_BATCH];
+        for chunk in redexes.chunks(REDEX_BATCH) {
+            for (i, (a, b)) in chunk.iter().enumerate() {
+                buf[2 * i] = a.0;
+                buf[2 * i + 1] = b.0;
+            }
+            unsafe {
+                def_add_redexes(self.def, buf.as_ptr(), chunk.len() as u64);
+            }
+        }
+    }
+
     pub fn add_var(&mut self) -> (Node, Node) {
         let var_idx = unsafe { def_add_var(self.def) };
         (Node::var(var_idx), Node::var(var_idx))
     }
 
+    pub fn add_aux(&mut self, nodes: &[Node]) -> Aux {
+        assert!(!nodes.is_empty() && nodes.len() <= 256, "aux must have between 1 and 256 nodes.");
+        let size = nodes.len() as u32;
+        unsafe { Aux(def_add_aux(self.def, size, nodes.as_ptr() as *const u64)) }
+    }
+
+    /// Adds `nodes.len() / size` aux blocks of `size` nodes each with a single call into the VM, returning them in order.
+    pub fn add_auxes(&mut self, size: usize, nodes: &[Node]) -> impl Iterator<Item = Aux> {
+        assert!(size >= 1 && size <= 256, "aux must have between 1 and 256 nodes.");
+        assert!(nodes.len() % size == 0, "nodes must split into blocks of the same size.");
+        let n = (nodes.len() / size) as u64;
+        let size = size as u64;
+        let begin = if n == 0 {
+            0
+        } else {
+            unsafe { Aux(def_add_aux_blocks(self.def, size as u32, n, nodes.as_ptr() as *const u64)).begin() }
+        };
+        (0..n).map(move |i| Aux::new(size, begin + i * size))
+    }
+
     pub fn con(&mut self, nodes: &[Node]) -> Node {
-        self.book.con(nodes)
+        Node::con(self.add_aux(nodes))
     }
 
     pub fn dup(&mut self, nodes: &[Node]) -> Node {
-        self.book.dup(nodes)
+        Node::dup(self.add_aux(nodes))
+    }
+
+    /// Branches on a number: a value in [i, i + 1) selects `branches[i]`, anything else selects the last branch.
+    /// The selected branch is connected to the returned node and the others are erased.
+    pub fn switch(&mut self, value: Node, branches: Vec<Node>) -> Node {
+        assert!(!branches.is_empty() && branches.len() <= 255, "switch must have between 1 and 255 branches.");
+        let (out, res) = self.add_var();
+        let mut nodes = Vec::with_capacity(branches.len() + 1);
+        nodes.push(out);
+        nodes.extend(branches);
+        let swi = Node::swi(self.add_aux(&nodes));
+        self.add_redex(swi, value);
+        res
+    }
+
+    /// A reference to a def, which is expanded into a fresh instance of it once it interacts with something.
+    pub fn call(&mut self, def: DefID) -> Node {
+        Node::cal(def.0)
     }
 
     pub fn add_operation(&mut self, op: Operation, ins: Vec<Node>) -> Node {
         assert!(ins.len() <= 256, "operation can have at most 256 inputs.");
+        assert!(ins.len() >= op.min_inputs(), "operation needs at least {} inputs.", op.min_inputs());
         let op_idx = unsafe { def_add_oper(self.def, op.to_op_code(), ins.len() as u32) }; 
-        for (idx, node) in ins.into_iter().enumerate() {
-            self.add_redex(Node::opi(op_idx, idx as u64), node);
-        }
+        let redexes: Vec<_> = ins.into_iter().enumerate().map(|(idx, node)| (Node::opi(op_idx, idx as u64), node)).collect();
+        self.add_redexes(&redexes);
         Node::opo(op_idx)
     }
 
@@ -0,0 +1,95 @@
+use std::fmt;
+
+/// Something a run can run out of.
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub enum Resource {
+    /// The OS refused to commit more memory.
+    Memory,
+    Aux,
+    Vars,
+    Redexes,
+    Operations,
+    Interactions
+}
+
+/// Why a run failed. A failed run leaves the VM ready for the next one.
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub enum VmError {
+    /// The VM's address space couldn't be reserved.
+    Reserve,
+    /// A thread used up its share of a resource.
+    Exhausted { resource: Resource, thread: u32 },
+    /// The run went over one of the limits in `VmConfig::limits`.
+    LimitExceeded { resource: Resource, thread: u32 },
+    /// Nodes that can't interact met, like CON nodes of different arity or a call to a def that doesn't exist.
+    InvalidNet { thread: u32 },
+    /// A def ran out of space while the book was being built, or its template couldn't be compiled.
+    Book,
+    /// The VM's worker threads couldn't be started. Nothing was run, the next run tries again.
+    Spawn,
+    /// An error code this version doesn't know about.
+    Unknown(u32)
+}
+
+#[repr(C)]
+pub(crate) struct RawError {
+    code: u32,
+    tid: u32
+}
+
+// Error codes of the VM
+const VM_OK: u32 = 0;
+const VM_ERR_OUT_OF_MEMORY: u32 = 1;
+const VM_ERR_AUX_EXHAUSTED: u32 = 2;
+const VM_ERR_VAR_EXHAUSTED: u32 = 3;
+const VM_ERR_REDX_EXHAUSTED: u32 = 4;
+const VM_ERR_OPER_EXHAUSTED: u32 = 5;
+const VM_ERR_INTERACTION_LIMIT: u32 = 6;
+const VM_ERR_AUX_LIMIT: u32 = 7;
+const VM_ERR_VAR_LIMIT: u32 = 8;
+const VM_ERR_INVALID_NET: u32 = 9;
+const VM_ERR_BOOK: u32 = 10;
+const VM_ERR_THREAD: u32 = 11;
+
+impl VmError {
+
+    pub(crate) fn from_raw(raw: RawError) -> Option<Self> {
+        let thread = raw.tid;
+        let exhausted = |resource| Some(VmError::Exhausted { resource, thread });
+        let limit = |resource| Some(VmError::LimitExceeded { resource, thread });
+        match raw.code {
+            VM_OK => None,
+            VM_ERR_OUT_OF_MEMORY => exhausted(Resource::Memory),
+            VM_ERR_AUX_EXHAUSTED => exhausted(Resource::Aux),
+            VM_ERR_VAR_EXHAUSTED => exhausted(Resource::Vars),
+            VM_ERR_REDX_EXHAUSTED => exhausted(Resource::Redexes),
+            VM_ERR_OPER_EXHAUSTED => exhausted(Resource::Operations),
+            VM_ERR_INTERACTION_LIMIT => limit(Resource::Interactions),
+            VM_ERR_AUX_LIMIT => limit(Resource::Aux),
+            VM_ERR_VAR_LIMIT => limit(Resource::Vars),
+            VM_ERR_INVALID_NET => Some(VmError::InvalidNet { thread }),
+            VM_ERR_BOOK => Some(VmError::Book),
+            VM_ERR_THREAD => Some(VmError::Spawn),
+            code => Some(VmError::Unknown(code))
+        }
+    }
+
+}
+
+impl fmt::Display for VmError {
+
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            VmError::Reserve => write!(f, "failed to reserve VM memory"),
+            VmError::Exhausted { resource, thread } => write!(f, "thread {} ran out of {:?}", thread, resource),
+            VmError::LimitExceeded { resource, thread } => write!(f, "thread {} went over the {:?} limit", thread, resource),
+            VmError::InvalidNet { thread } => write!(f, "thread {} found an invalid interaction", thread),
+            VmError::Book => write!(f, "the book ran out of space while being built"),
+            VmError::Spawn => write!(f, "failed to start the worker threads"),
+            VmError::Unknown(code) => write!(f, "unknown VM error code {}", code)
+        }
+    }
+
+}
+
+impl std::error::Error for VmError {}
@@ -2,14 +2,134 @@
 use std::os::raw::c_void;
 
 pub mod book;
+pub mod error;
 pub mod node;
+pub mod stats;
+pub mod term;
+
+use error::{RawError, VmError};
+use stats::{RawStats, Stats};
+use term::{Readback, Term};
+
+/// How worker threads are pinned to CPUs.
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+#[repr(u32)]
+pub enum Pinning {
+    None,
+    /// Worker n runs on the n-th CPU the process may use.
+    Core,
+    /// Worker n runs on the CPUs of NUMA node (n mod nodes).
+    NumaNode
+}
+
+/// Caps on what a single run may use, 0 means no cap.
+/// A run that goes over one fails with `VmError::LimitExceeded`.
+/// Aux nodes and vars are counted in chunks of a few thousand per thread, interactions exactly.
+#[derive(Clone, Copy, Debug, Default)]
+#[repr(C)]
+pub struct Limits {
+    pub max_interactions: u64,
+    pub max_aux: u64,
+    pub max_vars: u64
+}
+
+#[derive(Clone, Copy, Debug)]
+#[repr(C)]
+pub struct VmConfig {
+    pub threads: u32,
+    pub pinning: Pinning,
+    /// How many ready operations a thread collects before performing them together.
+    /// 0 picks the VM's default.
+    pub operation_batch: u32,
+    pub limits: Limits,
+    /// How many nodes of the output are read back at most, see `RunOutput::complete`.
+    /// 0 picks the VM's default.
+    pub readback_nodes: u64
+}
+
+impl Default for VmConfig {
+
+    fn default() -> Self {
+        let threads = std::thread::available_parallelism().map(|n| n.get() as u32).unwrap_or(1);
+        Self {
+            threads,
+            pinning: Pinning::None,
+            operation_batch: 0,
+            limits: Limits::default(),
+            readback_nodes: 0
+        }
+    }
+
+}
 
 extern "C" {
-    fn run(book: *mut c_void);
+    fn vm_create(config: *const VmConfig) -> *mut c_void;
+    fn vm_free(vm: *mut c_void);
+    fn vm_eval(vm: *mut c_void, book: *mut c_void, stats: *mut RawStats, output: *mut Readback) -> RawError;
+    fn bench_instance_def(book: *mut c_void, def: u64, count: u64) -> f64;
+}
+
+pub struct RunOutput {
+    /// The normal form of the first def's output.
+    pub output: Term,
+    /// False if the output was too big to read back and got cut short.
+    pub complete: bool,
+    pub stats: Stats
+}
+
+/// A VM that can run any number of books.
+/// Its memory and worker threads are kept between runs and freed when it's dropped.
+pub struct Vm {
+    vm: *mut c_void
 }
 
-pub fn run_vm(book: book::Book) {
-    unsafe {
-        run(book.book);
+unsafe impl Send for Vm {}
+
+impl Vm {
+
+    pub fn new(config: &VmConfig) -> Result<Self, VmError> {
+        let vm = unsafe { vm_create(config) };
+        if vm.is_null() {
+            Err(VmError::Reserve)
+        } else {
+            Ok(Self { vm })
+        }
+    }
+
+    pub fn run(&mut self, book: &book::Book) -> Result<RunOutput, VmError> {
+        unsafe {
+            let mut stats = std::mem::MaybeUninit::<RawStats>::uninit();
+            let mut output = std::mem::MaybeUninit::<Readback>::uninit();
+            let error = vm_eval(self.vm, book.book, stats.as_mut_ptr(), output.as_mut_ptr());
+            let (output, complete) = Term::from_readback(output.assume_init());
+            let stats = Stats::from_raw(stats.assume_init());
+            match VmError::from_raw(error) {
+                Some(error) => Err(error),
+                None => Ok(RunOutput { output, complete, stats })
+            }
+        }
     }
+
+}
+
+impl Drop for Vm {
+
+    fn drop(&mut self) {
+        unsafe {
+            vm_free(self.vm);
+        }
+    }
+
+}
+
+/// Runs a single book on a VM of its own.
+pub fn run_vm(book: book::Book, config: &VmConfig) -> Result<RunOutput, VmError> {
+    Vm::new(config)?.run(&book)
+}
+
+/// Instances a def `count` times without reducing it, returning instances per second.
+/// Only meant for benchmarks.
+#[doc(hidden)]
+pub fn bench_instance(book: &mut book::Book, def: book::DefID, count: u64) -> f64 {
+    unsafe { bench_instance_def(book.book, def.0, count) }
 }
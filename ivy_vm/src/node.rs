@@ -6,41 +6,74 @@ pub struct Aux(pub(crate) u64);
 #[repr(C)]
 pub struct Node(pub(crate) u64);
 
-extern "C" {
+// Mirrors the NaN boxing in vm/node.h
+const QNAN: u64 = 0x7ffc000000000000;
+const U62_MASK: u64 = 0x3FFFFFFFFFFFFFFF;
+
+const F0: u64 = 1 << 48;
+const F1: u64 = 1 << 49;
+const F2: u64 = 1 << 63;
+
+const VAR_TAG: u64 = QNAN;
+const CAL_TAG: u64 = QNAN | F0;
+const CON_TAG: u64 = QNAN | F1;
+const DUP_TAG: u64 = QNAN | F0 | F1;
+const ERA_TAG: u64 = QNAN | F2;
+const OPI_TAG: u64 = QNAN | F0 | F2;
+const OPO_TAG: u64 = QNAN | F1 | F2;
+const SWI_TAG: u64 = QNAN | F0 | F1 | F2;
+
+impl Aux {
+
+    pub(crate) const fn new(size: u64, begin: u64) -> Self {
+        Self(((size - 1) << 40) | begin)
+    }
 
-    fn make_var(var: u64) -> u64;
-    fn make_con(aux: u64) -> u64;
-    fn make_dup(aux: u64) -> u64;
-    fn make_era() -> u64;
-    fn make_opi(op: u64, idx: u64) -> u64;
-    fn make_opo(op: u64) -> u64;
+    pub(crate) const fn begin(&self) -> u64 {
+        self.0 & ((1 << 40) - 1)
+    }
 
 }
 
 impl Node {
 
-    pub(crate) fn var(var: u64) -> Self {
-        Self(unsafe { make_var(var) })
+    pub(crate) const fn var(var: u64) -> Self {
+        Self(VAR_TAG | var)
     }
 
-    pub fn con(aux: Aux) -> Self {
-        Self(unsafe { make_con(aux.0) })
+    pub(crate) const fn cal(def: u64) -> Self {
+        Self(CAL_TAG | def)
     }
 
-    pub fn dup(aux: Aux) -> Self {
-        Self(unsafe { make_dup(aux.0) })
+    pub const fn con(aux: Aux) -> Self {
+        Self(CON_TAG | aux.0)
     }
 
-    pub fn era() -> Self {
-        Self(unsafe { make_era() })
+    pub const fn dup(aux: Aux) -> Self {
+        Self(DUP_TAG | aux.0)
     }
 
-    pub(crate) fn opi(op: u64, idx: u64) -> Self {
-        Self(unsafe { make_opi(op, idx) })
+    /// A switch. The first aux node is the output, the rest are the branches.
+    /// Built through `Def::switch`, which makes sure there is at least one branch.
+    pub(crate) const fn swi(aux: Aux) -> Self {
+        Self(SWI_TAG | aux.0)
     }
 
-    pub(crate) fn opo(op: u64) -> Self {
-        Self(unsafe { make_opo(op) })
+    /// A symbol holding the low 62 bits of `sym`.
+    pub const fn sym(sym: u64) -> Self {
+        Self(sym & U62_MASK)
+    }
+
+    pub const fn era() -> Self {
+        Self(ERA_TAG)
+    }
+
+    pub(crate) const fn opi(op: u64, idx: u64) -> Self {
+        Self(OPI_TAG | op | (idx << 40))
+    }
+
+    pub(crate) const fn opo(op: u64) -> Self {
+        Self(OPO_TAG | op)
     }
 
     pub fn as_f64(&self) -> Option<f64> {
@@ -52,6 +85,10 @@ impl Node {
         }
     }
 
+    pub fn as_sym(&self) -> Option<u64> {
+        self.as_f64().map(|_| self.0)
+    }
+
     pub unsafe fn copy(&self) -> Self {
         Self(self.0)
     }
@@ -64,4 +101,46 @@ impl From<f64> for Node {
         Self(value.to_bits())
     }
 
-}
\ No newline at end of file
+}
+#[cfg(test)]
+mod tests {
+    use super::{Aux, Node};
+
+    extern "C" {
+        fn make_var(var: u64) -> u64;
+        fn make_cal(def: u64) -> u64;
+        fn make_con(aux: u64) -> u64;
+        fn make_dup(aux: u64) -> u64;
+        fn make_swi(aux: u64) -> u64;
+        fn make_sym(sym: u64) -> u64;
+        fn make_era() -> u64;
+        fn make_opi(op: u64, idx: u64) -> u64;
+        fn make_opo(op: u64) -> u64;
+    }
+
+    #[test]
+    fn encoding_matches_vm() {
+        let idxs = [0, 1, 255, 1 << 20, (1 << 40) - 1];
+        let auxes = [Aux::new(1, 0), Aux::new(2, 17), Aux::new(256, (1 << 40) - 1)];
+        unsafe {
+            for idx in idxs {
+                assert_eq!(Node::var(idx).0, make_var(idx));
+                assert_eq!(Node::cal(idx).0, make_cal(idx));
+                assert_eq!(Node::opo(idx).0, make_opo(idx));
+                for slot in [0, 1, 255] {
+                    assert_eq!(Node::opi(idx, slot).0, make_opi(idx, slot));
+                }
+            }
+            for aux in auxes {
+                assert_eq!(Node::con(Aux(aux.0)).0, make_con(aux.0));
+                assert_eq!(Node::dup(Aux(aux.0)).0, make_dup(aux.0));
+                assert_eq!(Node::swi(Aux(aux.0)).0, make_swi(aux.0));
+            }
+            for sym in [0, 42, u64::MAX] {
+                assert_eq!(Node::sym(sym).0, make_sym(sym));
+            }
+            assert_eq!(Node::era().0, make_era());
+        }
+    }
+
+}
@@ -0,0 +1,113 @@
+/// Counters of one worker thread.
+#[derive(Clone, Copy, Debug, Default)]
+#[repr(C)]
+pub struct ThreadStats {
+    pub interactions: u64,
+    /// How many aux nodes, vars and operations the thread took from its segments.
+    pub aux_peak: u64,
+    pub var_peak: u64,
+    pub operation_peak: u64,
+    /// Freed aux nodes, vars and operations the thread holds on its free lists at the end of the run.
+    /// Compared with the peaks, this shows how fragmented the segments got.
+    pub aux_free: u64,
+    pub var_free: u64,
+    pub operation_free: u64,
+    /// Slots freed into other threads' segments.
+    /// Only gathered with the `stats` feature, like everything below.
+    pub remote_frees: u64,
+    /// Redexes pushed to the stealable bag and to the priority bag.
+    pub redex_pushes: u64,
+    pub priority_pushes: u64,
+    /// The most redexes the bags held at once.
+    pub redex_peak: u64,
+    pub priority_peak: u64,
+    /// Seconds spent performing operations.
+    pub operation_time: f64
+}
+
+/// How many times each interaction rule fired.
+/// Only gathered with the `stats` feature.
+#[derive(Clone, Copy, Debug, Default)]
+#[repr(C)]
+pub struct RuleCounts {
+    pub link: u64,
+    pub call: u64,
+    pub anni: u64,
+    pub comm: u64,
+    pub eras: u64,
+    pub void: u64,
+    pub inpl: u64,
+    pub outl: u64,
+    pub swit: u64,
+    pub kili: u64,
+    pub kilo: u64
+}
+
+#[repr(C)]
+pub(crate) struct RawStats {
+    pub(crate) enabled: u32,
+    pub(crate) n_threads: u32,
+    pub(crate) interactions: u64,
+    pub(crate) time_taken: f64,
+    pub(crate) peak_memory: u64,
+    pub(crate) erasures_skipped: u64,
+    pub(crate) operations_batched: u64,
+    pub(crate) rules: RuleCounts,
+    pub(crate) threads: *mut ThreadStats
+}
+
+extern "C" {
+    fn free_stats(stats: *mut RawStats);
+}
+
+/// Statistics about a run of the VM.
+#[derive(Clone, Debug, Default)]
+pub struct Stats {
+    /// Whether the VM was built with the `stats` feature.
+    /// Without it the rule counts and the per-thread bag and operation figures are zero.
+    pub enabled: bool,
+    pub interactions: u64,
+    /// Wall-clock seconds spent reducing.
+    pub time_taken: f64,
+    /// Bytes of VM memory committed at the peak of the run, as if the VM was fresh.
+    pub peak_memory: u64,
+    pub rules: RuleCounts,
+    /// Erasures that were dropped because they would have been no-ops.
+    pub erasures_skipped: u64,
+    /// Operations evaluated in batched sweeps rather than one at a time.
+    pub operations_batched: u64,
+    pub threads: Vec<ThreadStats>
+}
+
+impl Stats {
+
+    /// Consumes stats written by the VM, releasing the memory it allocated for them.
+    pub(crate) unsafe fn from_raw(mut raw: RawStats) -> Self {
+        let threads = if raw.threads.is_null() {
+            Vec::new()
+        } else {
+            std::slice::from_raw_parts(raw.threads, raw.n_threads as usize).to_vec()
+        };
+        let stats = Self {
+            enabled: raw.enabled != 0,
+            interactions: raw.interactions,
+            time_taken: raw.time_taken,
+            peak_memory: raw.peak_memory,
+            rules: raw.rules,
+            erasures_skipped: raw.erasures_skipped,
+            operations_batched: raw.operations_batched,
+            threads
+        };
+        free_stats(&mut raw);
+        stats
+    }
+
+    pub fn mips(&self) -> f64 {
+        self.interactions as f64 / self.time_taken / 1_000_000.0
+    }
+
+    pub fn interactions_per_thread(&self) -> f64 {
+        self.interactions as f64 / self.threads.len().max(1) as f64
+    }
+
+}
@@ -0,0 +1,104 @@
+use crate::book::DefID;
+
+/// A node of a net read back from the VM once it's done reducing.
+#[derive(Clone, Debug, PartialEq)]
+pub enum Term {
+    /// A number or a symbol, see `Term::as_sym`.
+    Num(f64),
+    Era,
+    Con(Vec<Term>),
+    Dup(Vec<Term>),
+    Swi(Vec<Term>),
+    /// A wire. Both of its ends show up as the same variable,
+    /// a variable that appears once is a free port.
+    Var(u64),
+    /// A call that nothing ever needed the result of.
+    Call(DefID),
+    /// Ports of an operation that was never performed.
+    /// Operations only run once their output is linked to something, an output left in the net doesn't count.
+    OpInput(u64, u32),
+    OpOutput(u64),
+    /// Missing because the net was too big to read back in full.
+    Nil
+}
+
+impl Term {
+
+    pub fn as_f64(&self) -> Option<f64> {
+        match self {
+            Term::Num(num) => Some(*num),
+            _ => None
+        }
+    }
+
+    pub fn as_sym(&self) -> Option<u64> {
+        self.as_f64().map(f64::to_bits)
+    }
+
+}
+
+#[repr(C)]
+pub(crate) struct ReadbackNode {
+    value: u64,
+    kind: u32,
+    arity: u32
+}
+
+#[repr(C)]
+pub(crate) struct Readback {
+    nodes: *mut ReadbackNode,
+    len: u64,
+    truncated: u32
+}
+
+extern "C" {
+    fn free_readback(readback: *mut Readback);
+}
+
+// Dispatch table indices of the VM's node kinds
+const KIND_VAR: u32 = 0;
+const KIND_CAL: u32 = 1;
+const KIND_CON: u32 = 2;
+const KIND_DUP: u32 = 3;
+const KIND_ERA: u32 = 4;
+const KIND_OPI: u32 = 5;
+const KIND_OPO: u32 = 6;
+const KIND_SWI: u32 = 7;
+const KIND_SYM: u32 = 8;
+
+impl Term {
+
+    /// Consumes a readback written by the VM, releasing the memory it allocated for it.
+    /// Returns whether the net was read back in full.
+    pub(crate) unsafe fn from_readback(mut readback: Readback) -> (Self, bool) {
+        let nodes = if readback.nodes.is_null() {
+            &[][..]
+        } else {
+            std::slice::from_raw_parts(readback.nodes, readback.len as usize)
+        };
+
+        // The nodes are in preorder, so building them back to front
+        // always finds a node's aux ports on top of the stack, first port last
+        let mut stack: Vec<Term> = Vec::new();
+        for node in nodes.iter().rev() {
+            let mut aux = || (0..node.arity).map(|_| stack.pop().unwrap_or(Term::Nil)).collect();
+            let term = match node.kind {
+                KIND_VAR => Term::Var(node.value),
+                KIND_CAL => Term::Call(DefID(node.value)),
+                KIND_CON => Term::Con(aux()),
+                KIND_DUP => Term::Dup(aux()),
+                KIND_ERA => Term::Era,
+                KIND_OPI => Term::OpInput(node.value, node.arity),
+                KIND_OPO => Term::OpOutput(node.value),
+                KIND_SWI => Term::Swi(aux()),
+                KIND_SYM => Term::Num(f64::from_bits(node.value)),
+                _ => Term::Nil
+            };
+            stack.push(term);
+        }
+        let complete = readback.truncated == 0;
+        free_readback(&mut readback);
+        (stack.pop().unwrap_or(Term::Nil), complete)
+    }
+
+}
@@ -4,110 +4,582 @@
 
 Book* create_book() {
     Book* book = malloc(sizeof(Book));    
-    book->aux_curr = 0;
+    if(book == NULL) {
+        return NULL;
+    }
+    book->defs_len = 0;
+    book->defs_cap = 0;
+    book->defs = NULL;
+    book->max_vars = 0;
+    book->max_oper = 0;
+    book->max_aux = 0;
+    book->failed = false;
+    book->map = NULL;
+    book->map_size = 0;
+    memset(&book->sink, 0, sizeof(Def));
+    book->sink.failed = true;
     return book;
 }
 
+static void destroy_def(Def* def) {
+    if(def->mapped) {
+        free(def);
+        return;
+    }
+    free(def->redx_buf);
+    free(def->aux_buf);
+    free(def->oper_ops);
+    free(def->oper_ins);
+    free(def->tmpl);
+    free(def);
+}
+
 void destroy_book(Book* book) {
+    for(u64 i = 0; i < book->defs_len; i++) {
+        destroy_def(book->defs[i]);
+    }
+    free(book->defs);
+    if(book->map != NULL) {
+        unmap_book_file(book->map, book->map_size);
+    }
     free(book);
 }
 
-static inline Node update_node(NetVM* vm, ThreadMem* mem, Node node, Node* aux_buf);
+bool reserve(void** buf, u64* cap, u64 len, u64 extra, u64 elem_size) {
+    if(len + extra <= *cap) {
+        return true;
+    }
+    u64 new_cap = *cap == 0 ? 16 : *cap * 2;
+    while(new_cap < len + extra) {
+        new_cap *= 2;
+    }
+    void* new_buf = realloc(*buf, new_cap * elem_size);
+    if(new_buf == NULL) {
+        return false;
+    }
+    *buf = new_buf;
+    *cap = new_cap;
+    return true;
+}
 
-static inline Aux update_aux(NetVM* vm, ThreadMem* mem, Aux aux, Node* aux_buf) {
-    u64 aux_size = AUX_SIZE(aux);
-    u64 aux_begin = AUX_BEGIN(aux);
-    Node* aux_nodes = &aux_buf[aux_begin]; 
+typedef struct {
+    u64   len;
+    u64   cap;
+    Node* nodes;
+    u8*   kinds;
+} TemplateNodes;
 
-    Aux new_aux = alloc_aux(vm, mem, aux_size);
-    Node* new_aux_nodes = get_aux(vm, new_aux);
-    for(u32 i = 0; i < aux_size; i++) {
-        new_aux_nodes[i] = update_node(vm, mem, aux_nodes[i], aux_buf);
-    }
+typedef struct {
+    Def* def;
+
+    // Aux blocks found so far. Until a block is laid out it holds the def's aux it was found at.
+    u64  n_aux;
+    u64  aux_cap;
+    Aux* aux;
+
+    // Nodes of the aux blocks, and nodes of the redexes and output.
+    // The roots go after the aux blocks in the template, but how many aux nodes there are is only known at the end.
+    TemplateNodes aux_nodes;
+    TemplateNodes root_nodes;
 
-    return new_aux;
+    bool classes[256];
+    // Set once an allocation fails, after which nothing more is added
+    bool failed;
+} DefCompiler;
+
+static void push_template_node(DefCompiler* comp, TemplateNodes* list, Node node, u8 kind) {
+    u64 cap = list->cap;
+    if(!reserve((void**)&list->nodes, &cap, list->len, 1, sizeof(Node))
+        || !reserve((void**)&list->kinds, &list->cap, list->len, 1, sizeof(u8))) {
+        comp->failed = true;
+        return;
+    }
+    list->nodes[list->len] = node;
+    list->kinds[list->len] = kind;
+    list->len++;
 }
 
-static inline Node update_node(NetVM* vm, ThreadMem* mem, Node node, Node* aux_buf) {
-    if(NODE_IS_VAR(node)) {
-        return NODE_VAR(mem->instance_vars[NODE_GET_VAR_IDX(node)]);
-    } else if(NODE_IS_CON(node)) {
-        return NODE_CON(update_aux(vm, mem, NODE_GET_CON_AUX(node), aux_buf));
-    } else if(NODE_IS_DUP(node)) {
-        return NODE_DUP(update_aux(vm, mem, NODE_GET_CON_AUX(node), aux_buf));
-    } else if(NODE_IS_ERA(node)) {
-        return NODE_ERA;
+// Appends the template form of a node. CON/DUP/SWI nodes get a new aux block that is laid out later.
+static void compile_node(DefCompiler* comp, TemplateNodes* list, Node node) {
+    if(NODE_IS_CON(node) || NODE_IS_DUP(node) || NODE_IS_SWI(node)) {
+        if(!reserve((void**)&comp->aux, &comp->aux_cap, comp->n_aux, 1, sizeof(Aux))) {
+            comp->failed = true;
+            return;
+        }
+        comp->aux[comp->n_aux] = node & U48_MASK;
+        push_template_node(comp, list, (node & NODE_TAG_MASK) | comp->n_aux, RELOC_AUX);
+        comp->n_aux++;
+    } else if(NODE_IS_VAR(node)) {
+        push_template_node(comp, list, node, RELOC_VAR);
     } else if(NODE_IS_OPI(node)) {
-        return NODE_OPI(mem->instance_oper[NODE_GET_OPI_OP(node)], NODE_GET_OPI_IDX(node));
+        push_template_node(comp, list, node, RELOC_OPI);
     } else if(NODE_IS_OPO(node)) {
-        return NODE_OPO(mem->instance_oper[NODE_GET_OPO_OP(node)]);
-    } else if(NODE_IS_SWI(node)) {
+        push_template_node(comp, list, node, RELOC_OPO);
+    } else {
+        push_template_node(comp, list, node, RELOC_NONE);
+    }
+}
+
+u64 template_size(u64 redx_len, u64 oper_len, u64 aux_len, u64 n_aux, u32 n_classes) {
+    u64 nodes_len = aux_len + 2 * redx_len + 1;
+    return sizeof(Node) * nodes_len + sizeof(Aux) * n_aux + sizeof(u64) * oper_len + sizeof(u32) * oper_len + nodes_len + n_classes;
+}
+
+void set_template(Def* def, void* tmpl, u64 aux_len, u64 n_aux, u32 n_classes) {
+    u64 nodes_len = aux_len + 2 * def->redx_len + 1;
+    u64 nodes_size = sizeof(Node) * nodes_len;
+    u64 aux_size = sizeof(Aux) * n_aux;
+    u64 ops_size = sizeof(u64) * def->oper_len;
+    u64 ins_size = sizeof(u32) * def->oper_len;
+    u8* base = tmpl;
+    def->tmpl = tmpl;
+    def->tmpl_aux_len = aux_len;
+    def->tmpl_n_aux = n_aux;
+    def->tmpl_nodes = (Node*)base;
+    def->tmpl_aux = (Aux*)(base + nodes_size);
+    def->tmpl_ops = (u64*)(base + nodes_size + aux_size);
+    def->tmpl_ins = (u32*)(base + nodes_size + aux_size + ops_size);
+    def->tmpl_kinds = base + nodes_size + aux_size + ops_size + ins_size;
+    def->tmpl_n_classes = n_classes;
+    def->tmpl_classes = def->tmpl_kinds + nodes_len;
+}
+
+static void free_compiler(DefCompiler* comp) {
+    free(comp->aux);
+    free(comp->aux_nodes.nodes);
+    free(comp->aux_nodes.kinds);
+    free(comp->root_nodes.nodes);
+    free(comp->root_nodes.kinds);
+}
+
+// Returns false if the template couldn't be allocated
+static bool compile_def(Def* def) {
+    DefCompiler comp = {0};
+    comp.def = def;
+
+    // Aux blocks are laid out breadth first, in the order they are found.
+    // Each root's blocks are laid out before moving to the next root, so they end up contiguous.
+    u64 next_aux = 0;
+    for(u64 i = 0; i <= def->redx_len * 2 && !comp.failed; i++) {
+        Node root = i < def->redx_len * 2 ? ((Node*)def->redx_buf)[i] : def->out;
+        compile_node(&comp, &comp.root_nodes, root);
+
+        while(next_aux < comp.n_aux && !comp.failed) {
+            Aux src = comp.aux[next_aux];
+            u64 size = AUX_SIZE(src);
+            comp.aux[next_aux] = MAKE_AUX(size, comp.aux_nodes.len);
+            comp.classes[size - 1] = true;
+            next_aux++;
+            for(u64 j = 0; j < size; j++) {
+                compile_node(&comp, &comp.aux_nodes, def->aux_buf[AUX_BEGIN(src) + j]);
+            }
+        }
+    }
+    if(comp.failed) {
+        free_compiler(&comp);
+        return false;
+    }
+
+    u64 aux_len = comp.aux_nodes.len;
+    u32 n_classes = 0;
+    for(u32 i = 0; i < 256; i++) {
+        n_classes += comp.classes[i];
+    }
+
+    void* tmpl = malloc(template_size(def->redx_len, def->oper_len, aux_len, comp.n_aux, n_classes));
+    if(tmpl == NULL) {
+        free_compiler(&comp);
+        return false;
+    }
+    set_template(def, tmpl, aux_len, comp.n_aux, n_classes);
+
+    memcpy(def->tmpl_nodes, comp.aux_nodes.nodes, sizeof(Node) * aux_len);
+    memcpy(def->tmpl_nodes + aux_len, comp.root_nodes.nodes, sizeof(Node) * comp.root_nodes.len);
+    memcpy(def->tmpl_kinds, comp.aux_nodes.kinds, aux_len);
+    memcpy(def->tmpl_kinds + aux_len, comp.root_nodes.kinds, comp.root_nodes.len);
+    memcpy(def->tmpl_aux, comp.aux, sizeof(Aux) * comp.n_aux);
+    memcpy(def->tmpl_ops, def->oper_ops, sizeof(u64) * def->oper_len);
+    memcpy(def->tmpl_ins, def->oper_ins, sizeof(u32) * def->oper_len);
+    for(u32 i = 0, j = 0; i < 256; i++) {
+        if(comp.classes[i]) {
+            def->tmpl_classes[j] = i;
+            j++;
+        }
+    }
+
+    free_compiler(&comp);
+    return true;
+}
+
+bool book_finalize(Book* book) {
+    book->max_vars = 0;
+    book->max_oper = 0;
+    book->max_aux = 0;
+    if(book->failed) {
+        return false;
+    }
+    for(u64 i = 0; i < book->defs_len; i++) {
+        Def* def = book->defs[i];
+        if(def->failed || (def->tmpl == NULL && !compile_def(def))) {
+            return false;
+        }
+        if(def->vars > book->max_vars) {
+            book->max_vars = def->vars;
+        }
+        if(def->oper_len > book->max_oper) {
+            book->max_oper = def->oper_len;
+        }
+        if(def->tmpl_n_aux > book->max_aux) {
+            book->max_aux = def->tmpl_n_aux;
+        }
+    }
+    return true;
+}
+
+bool vm_set_book(NetVM* vm, Book* book) {
+    vm->book = book;
+    for(u32 tid = 0; tid < vm->n_threads; tid++) {
+        ThreadMem* mem = &vm->threads[tid];
+        u64* instance_vars = realloc(mem->instance_vars, sizeof(u64) * (book->max_vars + 1));
+        if(instance_vars == NULL) {
+            return false;
+        }
+        mem->instance_vars = instance_vars;
+        u64* instance_oper = realloc(mem->instance_oper, sizeof(u64) * (book->max_oper + 1));
+        if(instance_oper == NULL) {
+            return false;
+        }
+        mem->instance_oper = instance_oper;
+        Aux* instance_aux = realloc(mem->instance_aux, sizeof(Aux) * (book->max_aux + 1));
+        if(instance_aux == NULL) {
+            return false;
+        }
+        mem->instance_aux = instance_aux;
+    }
 
-    } else if(NODE_IS_SYM(node)) {
-        return node;
+    // The entry tables are only used for the first def
+    Def* entry = book->defs_len > 0 ? book->defs[0] : &book->sink;
+    u64* entry_vars = realloc(vm->entry_vars, sizeof(u64) * (entry->vars + 1));
+    if(entry_vars == NULL) {
+        return false;
+    }
+    vm->entry_vars = entry_vars;
+    u64* entry_oper = realloc(vm->entry_oper, sizeof(u64) * (entry->oper_len + 1));
+    if(entry_oper == NULL) {
+        return false;
     }
-    return NODE_NIL;
+    vm->entry_oper = entry_oper;
+    Aux* entry_aux = realloc(vm->entry_aux, sizeof(Aux) * (entry->tmpl_n_aux + 1));
+    if(entry_aux == NULL) {
+        return false;
+    }
+    vm->entry_aux = entry_aux;
+    return true;
+}
+
+static inline Node relocate(u64* vars, u64* oper, Aux* aux, Node node, u8 kind) {
+    switch(kind) {
+        case RELOC_VAR:
+            return NODE_VAR(vars[NODE_GET_VAR_IDX(node)]);
+        case RELOC_AUX:
+            return (node & NODE_TAG_MASK) | aux[node & U48_MASK];
+        case RELOC_OPI:
+            return NODE_OPI(oper[NODE_GET_OPI_OP(node)], NODE_GET_OPI_IDX(node));
+        case RELOC_OPO:
+            return NODE_OPO(oper[NODE_GET_OPO_OP(node)]);
+        default:
+            return node;
+    }
+}
+
+static inline Node relocate_node(ThreadMem* mem, Node node, u8 kind) {
+    return relocate(mem->instance_vars, mem->instance_oper, mem->instance_aux, node, kind);
 }
 
 // Create an instance of a definition, creating fresh auxes, variables, etc. Returns the output node of the definition
-Node instance_def(NetVM* vm, ThreadMem* mem, Book* book, Def* def) {
+Node instance_def(NetVM* vm, ThreadMem* mem, Def* def) {
 
     for(u32 i = 0; i < def->vars; i++) {
         mem->instance_vars[i] = alloc_var(vm, mem);
     }
 
     for(u32 i = 0; i < def->oper_len; i++) {
-        mem->instance_oper[i] = alloc_oper(vm, mem, def->oper_ops[i], def->oper_ins[i]);
+        mem->instance_oper[i] = alloc_oper(vm, mem, def->tmpl_ops[i], def->tmpl_ins[i]);
+    }
+
+    Node* nodes = def->tmpl_nodes;
+    u8* kinds = def->tmpl_kinds;
+
+    // All the aux blocks are bump allocated in one go, laid out as in the template.
+    // If freed blocks of the right sizes are around, they're recycled instead.
+    bool bulk = def->tmpl_aux_len > 0;
+    for(u32 i = 0; i < def->tmpl_n_classes; i++) {
+        if(has_free_aux(vm, mem, def->tmpl_classes[i] + 1)) {
+            bulk = false;
+            break;
+        }
     }
 
-    for(u32 i = 0; i < def->redx_len; i++) {
+    if(bulk) {
+        u64 base = alloc_aux_run(vm, mem, def->tmpl_aux_len);
+        for(u64 i = 0; i < def->tmpl_n_aux; i++) {
+            mem->instance_aux[i] = def->tmpl_aux[i] + base;
+        }
+        Node* aux_nodes = &vm->aux_buf[base];
+        for(u64 i = 0; i < def->tmpl_aux_len; i++) {
+            aux_nodes[i] = relocate_node(mem, nodes[i], kinds[i]);
+        }
+    } else {
+        for(u64 i = 0; i < def->tmpl_n_aux; i++) {
+            mem->instance_aux[i] = alloc_aux(vm, mem, AUX_SIZE(def->tmpl_aux[i]));
+        }
+        for(u64 i = 0; i < def->tmpl_n_aux; i++) {
+            Aux aux = def->tmpl_aux[i];
+            Node* aux_nodes = get_aux(vm, mem->instance_aux[i]);
+            u64 begin = AUX_BEGIN(aux);
+            for(u64 j = 0; j < AUX_SIZE(aux); j++) {
+                aux_nodes[j] = relocate_node(mem, nodes[begin + j], kinds[begin + j]);
+            }
+        }
+    }
+
+    nodes += def->tmpl_aux_len;
+    kinds += def->tmpl_aux_len;
+    for(u64 i = 0; i < def->redx_len; i++) {
+        push_redx(
+            vm,
+            mem,
+            relocate_node(mem, nodes[2 * i], kinds[2 * i]),
+            relocate_node(mem, nodes[2 * i + 1], kinds[2 * i + 1])
+        );
+    }
+
+    return relocate_node(mem, nodes[2 * def->redx_len], kinds[2 * def->redx_len]);
+}
+
+// The thread's share of n things
+static inline void entry_share(NetVM* vm, ThreadMem* mem, u64 n, u64* begin, u64* end) {
+    *begin = n * mem->tid / vm->n_threads;
+    *end = n * (mem->tid + 1) / vm->n_threads;
+}
+
+void entry_alloc(NetVM* vm, ThreadMem* mem, Def* def) {
+    u64 begin, end;
+
+    entry_share(vm, mem, def->vars, &begin, &end);
+    alloc_vars(vm, mem, end - begin, &vm->entry_vars[begin]);
+
+    entry_share(vm, mem, def->oper_len, &begin, &end);
+    for(u64 i = begin; i < end; i++) {
+        vm->entry_oper[i] = alloc_oper(vm, mem, def->tmpl_ops[i], def->tmpl_ins[i]);
+    }
+
+    // The template's blocks are laid out one after the other, so a share of them is a single run
+    entry_share(vm, mem, def->tmpl_n_aux, &begin, &end);
+    if(begin < end) {
+        u64 first = AUX_BEGIN(def->tmpl_aux[begin]);
+        u64 last = AUX_BEGIN(def->tmpl_aux[end - 1]) + AUX_SIZE(def->tmpl_aux[end - 1]);
+        u64 base = alloc_aux_run(vm, mem, last - first);
+        for(u64 i = begin; i < end; i++) {
+            vm->entry_aux[i] = def->tmpl_aux[i] - first + base;
+        }
+    }
+}
+
+Node entry_fill(NetVM* vm, ThreadMem* mem, Def* def) {
+    u64 begin, end;
+    Node* nodes = def->tmpl_nodes;
+    u8* kinds = def->tmpl_kinds;
+
+    entry_share(vm, mem, def->tmpl_n_aux, &begin, &end);
+    if(begin < end) {
+        u64 first = AUX_BEGIN(def->tmpl_aux[begin]);
+        u64 last = AUX_BEGIN(def->tmpl_aux[end - 1]) + AUX_SIZE(def->tmpl_aux[end - 1]);
+        Node* aux_nodes = &vm->aux_buf[AUX_BEGIN(vm->entry_aux[begin])];
+        for(u64 i = first; i < last; i++) {
+            aux_nodes[i - first] = relocate(vm->entry_vars, vm->entry_oper, vm->entry_aux, nodes[i], kinds[i]);
+        }
+    }
+
+    nodes += def->tmpl_aux_len;
+    kinds += def->tmpl_aux_len;
+    entry_share(vm, mem, def->redx_len, &begin, &end);
+    for(u64 i = begin; i < end; i++) {
         push_redx(
             vm,
             mem,
-            update_node(vm, mem, def->redx_buf[i].n0, book->aux_buf),
-            update_node(vm, mem, def->redx_buf[i].n1, book->aux_buf)
+            relocate(vm->entry_vars, vm->entry_oper, vm->entry_aux, nodes[2 * i], kinds[2 * i]),
+            relocate(vm->entry_vars, vm->entry_oper, vm->entry_aux, nodes[2 * i + 1], kinds[2 * i + 1])
         );
     }
 
-    return update_node(vm, mem, def->out, book->aux_buf);
+    return relocate(vm->entry_vars, vm->entry_oper, vm->entry_aux, nodes[2 * def->redx_len], kinds[2 * def->redx_len]);
 }
 
 // ======== BOOK MANIPULATION ========
 
-Aux add_aux(Book* book, u32 size, Node* nodes) {
-    memcpy(&book->aux_buf[book->aux_curr], nodes, sizeof(Node) * size);
-    book->aux_curr += size;
-    return MAKE_AUX(size, book->aux_curr - size);
+// The book and def builders don't fail on their own.
+// Running out of space marks the book or def as failed, later additions to it are dropped
+// and the failure is reported when the book is run.
+
+// Returns an ID get_def maps to the book's sink def if the def couldn't be added
+u64 add_def(Book* book) {
+    if(book->defs_len == BOOK_MAX_DEF || !reserve((void**)&book->defs, &book->defs_cap, book->defs_len, 1, sizeof(Def*))) {
+        book->failed = true;
+        return BOOK_MAX_DEF;
+    }
+    Def* def = calloc(1, sizeof(Def));
+    if(def == NULL) {
+        book->failed = true;
+        return BOOK_MAX_DEF;
+    }
+    def->out = NODE_ERA;
+    book->defs[book->defs_len] = def;
+    book->defs_len++;
+    return book->defs_len - 1;
 }
 
 Def* get_def(Book* book, u64 id) {
-    return &book->defs[id];
+    if(id >= book->defs_len) {
+        return &book->sink;
+    }
+    return book->defs[id];
 }
 
 // ======== DEF MANIPULATION ========
 
+// Copies the arrays of a def loaded from a book file out of the mapping, so it can be changed.
+// Returns false if they couldn't be allocated.
+static bool unmap_def(Def* def) {
+    Pair* redx_buf = malloc(sizeof(Pair) * def->redx_len + 1);
+    Node* aux_buf = malloc(sizeof(Node) * def->aux_len + 1);
+    u64* oper_ops = malloc(sizeof(u64) * def->oper_len + 1);
+    u32* oper_ins = malloc(sizeof(u32) * def->oper_len + 1);
+    if(redx_buf == NULL || aux_buf == NULL || oper_ops == NULL || oper_ins == NULL) {
+        free(redx_buf);
+        free(aux_buf);
+        free(oper_ops);
+        free(oper_ins);
+        return false;
+    }
+    memcpy(redx_buf, def->redx_buf, sizeof(Pair) * def->redx_len);
+    memcpy(aux_buf, def->aux_buf, sizeof(Node) * def->aux_len);
+    memcpy(oper_ops, def->oper_ops, sizeof(u64) * def->oper_len);
+    memcpy(oper_ins, def->oper_ins, sizeof(u32) * def->oper_len);
+    def->redx_buf = redx_buf;
+    def->redx_cap = def->redx_len;
+    def->aux_buf = aux_buf;
+    def->aux_cap = def->aux_len;
+    def->oper_ops = oper_ops;
+    def->oper_ins = oper_ins;
+    def->oper_cap = def->oper_len;
+    // The template is in the mapping too, it's compiled again on the next book_finalize
+    def->tmpl = NULL;
+    def->mapped = false;
+    return true;
+}
+
+bool def_modified(Def* def) {
+    if(def->failed) {
+        return false;
+    }
+    if(def->mapped && !unmap_def(def)) {
+        def->failed = true;
+        return false;
+    }
+    if(def->tmpl != NULL) {
+        free(def->tmpl);
+        def->tmpl = NULL;
+    }
+    return true;
+}
+
 void def_set_out(Def* def, Node out) {
+    if(!def_modified(def)) {
+        return;
+    }
     def->out = out;
 }
 
 u64 def_add_var(Def* def) {
+    if(!def_modified(def)) {
+        return 0;
+    }
+    if(def->vars == DEF_MAX_VAR) {
+        def->failed = true;
+        return 0;
+    }
     def->vars++;
     return def->vars - 1;
 }
 
+Aux def_add_aux(Def* def, u32 size, Node* nodes) {
+    if(!def_modified(def)) {
+        return MAKE_AUX(size, 0);
+    }
+    if(def->aux_len + size > DEF_MAX_AUX || !reserve((void**)&def->aux_buf, &def->aux_cap, def->aux_len, size, sizeof(Node))) {
+        def->failed = true;
+        return MAKE_AUX(size, 0);
+    }
+    memcpy(&def->aux_buf[def->aux_len], nodes, sizeof(Node) * size);
+    def->aux_len += size;
+    return MAKE_AUX(size, def->aux_len - size);
+}
+
+// Adds n blocks of the given size laid out one after the other in nodes.
+// Returns the first block, block i starts i * size nodes after it.
+Aux def_add_aux_blocks(Def* def, u32 size, u64 n, Node* nodes) {
+    if(!def_modified(def)) {
+        return MAKE_AUX(size, 0);
+    }
+    if(n > (DEF_MAX_AUX - def->aux_len) / size || !reserve((void**)&def->aux_buf, &def->aux_cap, def->aux_len, n * size, sizeof(Node))) {
+        def->failed = true;
+        return MAKE_AUX(size, 0);
+    }
+    memcpy(&def->aux_buf[def->aux_len], nodes, sizeof(Node) * n * size);
+    def->aux_len += n * size;
+    return MAKE_AUX(size, def->aux_len - n * size);
+}
+
 void def_add_redex(Def* def, Node a, Node b) {
-    if(def->redx_len == DEF_MAX_REDX) {
-        fprintf(stderr, "DEF REDEX SPACE EXHAUSTED\n");
-        exit(-1);
+    if(!def_modified(def)) {
+        return;
+    }
+    if(def->redx_len == DEF_MAX_REDX || !reserve((void**)&def->redx_buf, &def->redx_cap, def->redx_len, 1, sizeof(Pair))) {
+        def->failed = true;
+        return;
     }
     def->redx_buf[def->redx_len] = MAKE_PAIR(a, b);
     def->redx_len++;
 }
 
+void def_add_redexes(Def* def, Pair* pairs, u64 n) {
+    if(!def_modified(def)) {
+        return;
+    }
+    if(n > DEF_MAX_REDX - def->redx_len || !reserve((void**)&def->redx_buf, &def->redx_cap, def->redx_len, n, sizeof(Pair))) {
+        def->failed = true;
+        return;
+    }
+    memcpy(&def->redx_buf[def->redx_len], pairs, sizeof(Pair) * n);
+    def->redx_len += n;
+}
+
+// An op the VM doesn't know or with too few inputs fails the def, so it can't reach compute_operation
 u64 def_add_oper(Def* def, u64 op, u32 ins) {
-    if(def->oper_len == DEF_MAX_OPER) {
-        fprintf(stderr, "DEF OPER SPACE EXHAUSTED\n");
-        exit(-1);
+    if(!OP_IS_VALID(op) || ins < op_min_ins(op) || ins > OPER_MAX_INS) {
+        def->failed = true;
+        return 0;
+    }
+    if(!def_modified(def)) {
+        return 0;
+    }
+    u64 cap = def->oper_cap;
+    if(def->oper_len == DEF_MAX_OPER
+        || !reserve((void**)&def->oper_ops, &cap, def->oper_len, 1, sizeof(u64))
+        || !reserve((void**)&def->oper_ins, &def->oper_cap, def->oper_len, 1, sizeof(u32))) {
+        def->failed = true;
+        return 0;
     }
     def->oper_ops[def->oper_len] = op;
     def->oper_ins[def->oper_len] = ins;
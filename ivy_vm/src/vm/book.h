@@ -9,39 +9,157 @@
 
 #define DEF_MAX_VAR  (1ull << 26)
 #define DEF_MAX_REDX (1ull << 26)
+#define DEF_MAX_AUX  (1ull << 30)
 #define DEF_MAX_OPER (1ull << 26)
-#define DEF_MAX_ARGS 256
 
-typedef struct {
+typedef struct Def {
     u64 vars;
 
-    u64  redx_len;
-    Pair redx_buf[DEF_MAX_REDX];
+    // Growable arrays the def is built into
+    u64   redx_len;
+    u64   redx_cap;
+    Pair* redx_buf;
+
+    u64   aux_len;
+    u64   aux_cap;
+    Node* aux_buf;
+
+    u64  oper_len;
+    u64  oper_cap;
+    u64* oper_ops;
+    u32* oper_ins;
 
-    u64 oper_len;
-    u64 oper_ops[DEF_MAX_OPER];
-    u32 oper_ins[DEF_MAX_OPER];
+    Node out;
 
-    Node  args[DEF_MAX_ARGS];
-    Node  out;
+    // Set if the def ran out of space while being built, it can't be run
+    bool failed;
+    // Set if the arrays and template point into a mapped book file.
+    // They're copied out the first time the def is changed.
+    bool mapped;
+
+    // Instancing template compiled by book_finalize, everything instance_def reads laid out in one block.
+    // tmpl_nodes holds the nodes of every aux block reachable from the def, then the redex pairs, then the output.
+    // Each of those nodes has a relocation kind telling how to turn it into a node of the instance,
+    // for CON/DUP/SWI nodes the payload is replaced by the index of the aux block in tmpl_aux.
+    void* tmpl;
+    u64   tmpl_aux_len;
+    u64   tmpl_n_aux;
+    Node* tmpl_nodes;
+    u8*   tmpl_kinds;
+    // Size and offset in tmpl_nodes of every aux block
+    Aux*  tmpl_aux;
+    u64*  tmpl_ops;
+    u32*  tmpl_ins;
+    // The distinct aux sizes used by the template, minus one
+    u32   tmpl_n_classes;
+    u8*   tmpl_classes;
 } Def;
 
-#define BOOK_MAX_AUX (1ull << 30)
-#define BOOK_MAX_DEF (1ull << 16)
+// How a template node is turned into a node of an instance
+enum {
+    RELOC_NONE,
+    RELOC_VAR,
+    RELOC_AUX,
+    RELOC_OPI,
+    RELOC_OPO
+};
 
-typedef struct {
-    Node aux_buf[BOOK_MAX_AUX];
-    u64  aux_curr; 
+#define BOOK_MAX_DEF (1ull << 40)
+
+typedef struct Book {
+    u64   defs_len;
+    u64   defs_cap;
+    Def** defs;
 
-    Def defs[BOOK_MAX_DEF];
+    // The most variables and operations found in a single def, used to size the instancing buffers.
+    // Only valid after book_finalize.
+    u64 max_vars;
+    u64 max_oper;
+    u64 max_aux;
+
+    // Set if a def couldn't be added
+    bool failed;
+    // What get_def returns for IDs of defs that couldn't be added.
+    // It is marked as failed so nothing is ever added to it.
+    Def sink;
+
+    // The book file the defs were loaded from, NULL if the book was built in memory
+    void* map;
+    u64   map_size;
 } Book;
 
 Book* create_book();
 void destroy_book(Book* book);
 
+// Makes room for `extra` more elements in a growable array, doubling its capacity as needed.
+// Returns false if the array couldn't be grown.
+bool reserve(void** buf, u64* cap, u64 len, u64 extra, u64 elem_size);
+
+// Size of the block holding a def's template, and how the template is laid out in it
+u64 template_size(u64 redx_len, u64 oper_len, u64 aux_len, u64 n_aux, u32 n_classes);
+void set_template(Def* def, void* tmpl, u64 aux_len, u64 n_aux, u32 n_classes);
+
+// Compiles the instancing template of every def. Cheap to call again if nothing changed.
+// Returns false if the book or one of its defs ran out of space.
+bool book_finalize(Book* book);
+
 struct NetVM;
 struct ThreadMem;
 
-Node instance_def(NetVM* vm, ThreadMem* mem, Book* book, Def* def);
+// Prepares the VM for instancing the defs of a finalized book
+bool vm_set_book(NetVM* vm, Book* book);
+
+Node instance_def(NetVM* vm, ThreadMem* mem, Def* def);
+
+// The two phases of instancing the entry def with every worker taking a share of it, see vm_eval.
+// entry_alloc allocates the thread's share of the vars, operations and aux blocks into the VM's entry tables.
+// Once every thread is done with it, entry_fill writes the thread's aux blocks and pushes its share of the redexes.
+// Returns the output node of the instance.
+void entry_alloc(NetVM* vm, ThreadMem* mem, Def* def);
+Node entry_fill(NetVM* vm, ThreadMem* mem, Def* def);
+
+// Any change to a def invalidates its template.
+// Returns false if the def can't be changed because it ran out of space.
+bool def_modified(Def* def);
+
+// ======== OPTIMIZATION ========
+
+typedef struct {
+    u64 calls_inlined;
+    u64 oper_folded;
+    // Totals over every def of the book
+    u64 redx_before;
+    u64 redx_after;
+    u64 aux_before;
+    u64 aux_after;
+    u64 vars_before;
+    u64 vars_after;
+} BookOptStats;
+
+// Reduces what can be reduced in each def before the book is run, see optimize.c.
+// A def that runs out of memory on the way is marked as failed like it is by the builders.
+void book_optimize(Book* book, BookOptStats* stats);
+
+// ======== BOOK FILES ========
+
+// A book file holds every def's arrays and compiled template as they are laid out in memory,
+// so a loaded book is used straight from the mapping.
+// Files are only meant to be read on the kind of machine that wrote them.
+
+enum {
+    BOOK_FILE_OK,
+    // errno tells what went wrong
+    BOOK_FILE_IO,
+    // Not a book file, a file of another version or a truncated one
+    BOOK_FILE_INVALID,
+    // Native operations are function pointers, which don't mean anything in another process
+    BOOK_FILE_NATIVE,
+    // The book ran out of space while being built, see book_finalize
+    BOOK_FILE_FAILED
+};
+
+u32 book_save(Book* book, const char* path);
+u32 book_load(const char* path, Book** out);
+void unmap_book_file(void* map, u64 size);
 
 #endif
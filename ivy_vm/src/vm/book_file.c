@@ -0,0 +1,348 @@
+
+#include "book.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// "IVYBOOK" followed by a zero byte, read as a little endian u64
+#define BOOK_FILE_MAGIC 0x004b4f4f42595649ull
+#define BOOK_FILE_VERSION 1
+
+typedef struct {
+    u64 magic;
+    u32 version;
+    u32 reserved;
+    u64 file_size;
+    u64 defs_len;
+} BookFileHeader;
+
+// The header is followed by one of these per def, then by the arrays they point to
+typedef struct {
+    u64  vars;
+    Node out;
+    u64  redx_len;
+    u64  aux_len;
+    u64  oper_len;
+    u64  tmpl_aux_len;
+    u64  tmpl_n_aux;
+    u64  tmpl_n_classes;
+    // Offsets from the start of the file, all 8 byte aligned
+    u64  redx_offset;
+    u64  aux_offset;
+    u64  ops_offset;
+    u64  ins_offset;
+    u64  tmpl_offset;
+} BookFileDef;
+
+static inline u64 pad8(u64 size) {
+    return (size + 7) & ~7ull;
+}
+
+static inline u64 def_template_size(Def* def) {
+    return template_size(def->redx_len, def->oper_len, def->tmpl_aux_len, def->tmpl_n_aux, def->tmpl_n_classes);
+}
+
+static bool write_padded(FILE* file, const void* data, u64 size) {
+    static const u8 zeros[8] = {0};
+    if(size > 0 && fwrite(data, 1, size, file) != size) {
+        return false;
+    }
+    u64 pad = pad8(size) - size;
+    return pad == 0 || fwrite(zeros, 1, pad, file) == pad;
+}
+
+// ======== SAVING ========
+
+static bool write_book(FILE* file, Book* book, BookFileHeader* header, BookFileDef* table) {
+    if(!write_padded(file, header, sizeof(BookFileHeader))
+        || !write_padded(file, table, sizeof(BookFileDef) * book->defs_len)) {
+        return false;
+    }
+    for(u64 i = 0; i < book->defs_len; i++) {
+        Def* def = book->defs[i];
+        if(!write_padded(file, def->redx_buf, sizeof(Pair) * def->redx_len)
+            || !write_padded(file, def->aux_buf, sizeof(Node) * def->aux_len)
+            || !write_padded(file, def->oper_ops, sizeof(u64) * def->oper_len)
+            || !write_padded(file, def->oper_ins, sizeof(u32) * def->oper_len)
+            || !write_padded(file, def->tmpl, def_template_size(def))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+u32 book_save(Book* book, const char* path) {
+    if(!book_finalize(book)) {
+        return BOOK_FILE_FAILED;
+    }
+    for(u64 i = 0; i < book->defs_len; i++) {
+        Def* def = book->defs[i];
+        for(u64 j = 0; j < def->oper_len; j++) {
+            if(def->oper_ops[j] & OP_NATIVE) {
+                return BOOK_FILE_NATIVE;
+            }
+        }
+    }
+
+    BookFileDef* table = calloc(book->defs_len + 1, sizeof(BookFileDef));
+    if(table == NULL) {
+        return BOOK_FILE_IO;
+    }
+    u64 offset = pad8(sizeof(BookFileHeader)) + pad8(sizeof(BookFileDef) * book->defs_len);
+    for(u64 i = 0; i < book->defs_len; i++) {
+        Def* def = book->defs[i];
+        BookFileDef* entry = &table[i];
+        entry->vars = def->vars;
+        entry->out = def->out;
+        entry->redx_len = def->redx_len;
+        entry->aux_len = def->aux_len;
+        entry->oper_len = def->oper_len;
+        entry->tmpl_aux_len = def->tmpl_aux_len;
+        entry->tmpl_n_aux = def->tmpl_n_aux;
+        entry->tmpl_n_classes = def->tmpl_n_classes;
+        entry->redx_offset = offset;
+        offset += pad8(sizeof(Pair) * def->redx_len);
+        entry->aux_offset = offset;
+        offset += pad8(sizeof(Node) * def->aux_len);
+        entry->ops_offset = offset;
+        offset += pad8(sizeof(u64) * def->oper_len);
+        entry->ins_offset = offset;
+        offset += pad8(sizeof(u32) * def->oper_len);
+        entry->tmpl_offset = offset;
+        offset += pad8(def_template_size(def));
+    }
+
+    BookFileHeader header = {
+        .magic = BOOK_FILE_MAGIC,
+        .version = BOOK_FILE_VERSION,
+        .reserved = 0,
+        .file_size = offset,
+        .defs_len = book->defs_len
+    };
+
+    FILE* file = fopen(path, "wb");
+    if(file == NULL) {
+        free(table);
+        return BOOK_FILE_IO;
+    }
+    bool ok = write_book(file, book, &header, table);
+    int err = errno;
+    ok = fclose(file) == 0 && ok;
+    free(table);
+    if(!ok) {
+        errno = err;
+        return BOOK_FILE_IO;
+    }
+    return BOOK_FILE_OK;
+}
+
+// ======== LOADING ========
+
+// Whether [offset, offset + size) lies inside the file
+static inline bool in_file(u64 file_size, u64 offset, u64 size) {
+    return offset % 8 == 0 && offset <= file_size && size <= file_size - offset;
+}
+
+// Whether a node of the def's source form only refers to things the def has.
+// compile_def and book_optimize read these once the def is copied out of the file.
+static bool check_node(Def* def, Node node, u64 defs_len) {
+    if(NODE_IS_NULLARY(node)) {
+        return true;
+    } else if(NODE_IS_CAL(node)) {
+        return NODE_GET_CAL_IDX(node) < defs_len;
+    } else if(NODE_IS_VAR(node)) {
+        return NODE_GET_VAR_IDX(node) < def->vars;
+    } else if(NODE_IS_CON(node) || NODE_IS_DUP(node) || NODE_IS_SWI(node)) {
+        Aux aux = node & U48_MASK;
+        return AUX_BEGIN(aux) + AUX_SIZE(aux) <= def->aux_len;
+    } else if(NODE_IS_OPI(node)) {
+        return NODE_GET_OPI_OP(node) < def->oper_len && NODE_GET_OPI_IDX(node) < def->oper_ins[NODE_GET_OPI_OP(node)];
+    } else if(NODE_IS_OPO(node)) {
+        return NODE_GET_OPO_OP(node) < def->oper_len;
+    }
+    return false;
+}
+
+static bool check_source(Def* def, u64 defs_len) {
+    if(!check_node(def, def->out, defs_len)) {
+        return false;
+    }
+    for(u64 i = 0; i < def->redx_len * 2; i++) {
+        if(!check_node(def, ((Node*)def->redx_buf)[i], defs_len)) {
+            return false;
+        }
+    }
+    for(u64 i = 0; i < def->aux_len; i++) {
+        if(!check_node(def, def->aux_buf[i], defs_len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Checks every index instance_def takes from the template stays inside the tables it indexes,
+// and every operation is a built-in one.
+// Nodes that aren't relocated are copied into the net as they are, so only those without an index may skip it.
+// The blocks must be laid out one after the other, as book_finalize lays them out.
+static bool check_template(Def* def, u64 defs_len) {
+    u64 aux_end = 0;
+    for(u64 i = 0; i < def->tmpl_n_aux; i++) {
+        if(AUX_BEGIN(def->tmpl_aux[i]) != aux_end || def->tmpl_aux[i] >> 48 != 0) {
+            return false;
+        }
+        aux_end += AUX_SIZE(def->tmpl_aux[i]);
+    }
+    if(aux_end != def->tmpl_aux_len) {
+        return false;
+    }
+    // Saved books have no native operations, an address in a file can't be called
+    for(u64 i = 0; i < def->oper_len; i++) {
+        if(def->tmpl_ops[i] >= OP_COUNT || def->oper_ops[i] >= OP_COUNT
+            || def->tmpl_ins[i] < op_min_ins(def->tmpl_ops[i]) || def->oper_ins[i] < op_min_ins(def->oper_ops[i])
+            || def->tmpl_ins[i] > OPER_MAX_INS || def->oper_ins[i] > OPER_MAX_INS) {
+            return false;
+        }
+    }
+
+    u64 nodes_len = def->tmpl_aux_len + 2 * def->redx_len + 1;
+    for(u64 i = 0; i < nodes_len; i++) {
+        Node node = def->tmpl_nodes[i];
+        bool valid;
+        switch(def->tmpl_kinds[i]) {
+            case RELOC_NONE:
+                valid = NODE_IS_NULLARY(node) || (NODE_IS_CAL(node) && NODE_GET_CAL_IDX(node) < defs_len);
+                break;
+            case RELOC_VAR:
+                valid = NODE_GET_VAR_IDX(node) < def->vars;
+                break;
+            case RELOC_AUX:
+                // The tag is kept, only the block index is relocated
+                valid = (NODE_IS_CON(node) || NODE_IS_DUP(node) || NODE_IS_SWI(node)) && (node & U48_MASK) < def->tmpl_n_aux;
+                break;
+            case RELOC_OPI:
+                valid = NODE_GET_OPI_OP(node) < def->oper_len && NODE_GET_OPI_IDX(node) < def->tmpl_ins[NODE_GET_OPI_OP(node)];
+                break;
+            case RELOC_OPO:
+                valid = NODE_GET_OPO_OP(node) < def->oper_len;
+                break;
+            default:
+                valid = false;
+        }
+        if(!valid) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Points a def at its arrays in the mapping, checking they're all inside it and the def only refers to things it has
+static bool attach_def(Def* def, u8* map, u64 size, u64 defs_len, BookFileDef* entry) {
+    if(entry->vars > DEF_MAX_VAR || entry->redx_len > DEF_MAX_REDX || entry->aux_len > DEF_MAX_AUX
+        || entry->oper_len > DEF_MAX_OPER || entry->tmpl_n_classes > 256
+        || entry->tmpl_aux_len > size || entry->tmpl_n_aux > size) {
+        return false;
+    }
+    u64 tmpl_size = template_size(entry->redx_len, entry->oper_len, entry->tmpl_aux_len, entry->tmpl_n_aux, entry->tmpl_n_classes);
+    if(!in_file(size, entry->redx_offset, sizeof(Pair) * entry->redx_len)
+        || !in_file(size, entry->aux_offset, sizeof(Node) * entry->aux_len)
+        || !in_file(size, entry->ops_offset, sizeof(u64) * entry->oper_len)
+        || !in_file(size, entry->ins_offset, sizeof(u32) * entry->oper_len)
+        || !in_file(size, entry->tmpl_offset, tmpl_size)) {
+        return false;
+    }
+
+    def->vars = entry->vars;
+    def->out = entry->out;
+    def->redx_len = entry->redx_len;
+    def->redx_cap = entry->redx_len;
+    def->redx_buf = (Pair*)(map + entry->redx_offset);
+    def->aux_len = entry->aux_len;
+    def->aux_cap = entry->aux_len;
+    def->aux_buf = (Node*)(map + entry->aux_offset);
+    def->oper_len = entry->oper_len;
+    def->oper_cap = entry->oper_len;
+    def->oper_ops = (u64*)(map + entry->ops_offset);
+    def->oper_ins = (u32*)(map + entry->ins_offset);
+    def->mapped = true;
+    set_template(def, map + entry->tmpl_offset, entry->tmpl_aux_len, entry->tmpl_n_aux, entry->tmpl_n_classes);
+    return check_template(def, defs_len) && check_source(def, defs_len);
+}
+
+static u32 attach_book(Book* book, u8* map, u64 size) {
+    BookFileHeader* header = (BookFileHeader*)map;
+    if(size < sizeof(BookFileHeader) || header->magic != BOOK_FILE_MAGIC
+        || header->version != BOOK_FILE_VERSION || header->file_size != size) {
+        return BOOK_FILE_INVALID;
+    }
+    if(header->defs_len > (size - pad8(sizeof(BookFileHeader))) / sizeof(BookFileDef)) {
+        return BOOK_FILE_INVALID;
+    }
+
+    BookFileDef* table = (BookFileDef*)(map + pad8(sizeof(BookFileHeader)));
+    book->defs = malloc(sizeof(Def*) * (header->defs_len + 1));
+    if(book->defs == NULL) {
+        return BOOK_FILE_IO;
+    }
+    book->defs_cap = header->defs_len + 1;
+    for(u64 i = 0; i < header->defs_len; i++) {
+        Def* def = calloc(1, sizeof(Def));
+        if(def == NULL) {
+            return BOOK_FILE_IO;
+        }
+        book->defs[book->defs_len] = def;
+        book->defs_len++;
+        if(!attach_def(def, map, size, header->defs_len, &table[i])) {
+            return BOOK_FILE_INVALID;
+        }
+    }
+    return BOOK_FILE_OK;
+}
+
+// The file is mapped read only and stays mapped until the book is destroyed
+u32 book_load(const char* path, Book** out) {
+    *out = NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return BOOK_FILE_IO;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return BOOK_FILE_IO;
+    }
+    u64 size = st.st_size;
+    if(size < sizeof(BookFileHeader)) {
+        close(fd);
+        return BOOK_FILE_INVALID;
+    }
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    close(fd);
+    if(map == MAP_FAILED) {
+        errno = err;
+        return BOOK_FILE_IO;
+    }
+
+    Book* book = create_book();
+    if(book == NULL) {
+        munmap(map, size);
+        return BOOK_FILE_IO;
+    }
+    book->map = map;
+    book->map_size = size;
+    u32 result = attach_book(book, map, size);
+    if(result != BOOK_FILE_OK) {
+        destroy_book(book);
+        return result;
+    }
+    *out = book;
+    return BOOK_FILE_OK;
+}
+
+void unmap_book_file(void* map, u64 size) {
+    munmap(map, size);
+}
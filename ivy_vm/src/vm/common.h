@@ -2,20 +2,26 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#define _GNU_SOURCE
+
 #include <math.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 typedef  uint8_t  u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
 typedef uint64_t u64;
 typedef  int32_t i32;
+typedef  int64_t i64;
 typedef    float f32;
 typedef   double f64;
 
@@ -23,6 +29,7 @@ typedef  _Atomic(u8)  a8;
 typedef _Atomic(u16) a16;
 typedef _Atomic(u32) a32;
 typedef _Atomic(u64) a64;
+typedef _Atomic(i64) ai64;
 typedef _Atomic(f64) af64;
 
 #endif
@@ -0,0 +1,45 @@
+
+#include "heap.h"
+#include <sys/mman.h>
+#include <unistd.h>
+
+static inline u64 page_size() {
+    static u64 size = 0;
+    if(size == 0) {
+        size = sysconf(_SC_PAGESIZE);
+    }
+    return size;
+}
+
+void* heap_reserve(u64 size) {
+    void* base = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(base == MAP_FAILED) {
+        return NULL;
+    }
+    return base;
+}
+
+void heap_unreserve(void* base, u64 size) {
+    munmap(base, size);
+}
+
+bool heap_commit(void* begin, void* end) {
+    u64 page = page_size();
+    u64 first = (u64)begin & ~(page - 1);
+    u64 last = ((u64)end + page - 1) & ~(page - 1);
+    if(first >= last) {
+        return true;
+    }
+    return mprotect((void*)first, last - first, PROT_READ | PROT_WRITE) == 0;
+}
+
+void heap_release(void* begin, void* end) {
+    u64 page = page_size();
+    u64 first = (u64)begin & ~(page - 1);
+    u64 last = ((u64)end + page - 1) & ~(page - 1);
+    if(first >= last) {
+        return;
+    }
+    madvise((void*)first, last - first, MADV_DONTNEED);
+    mprotect((void*)first, last - first, PROT_NONE);
+}
@@ -0,0 +1,23 @@
+
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "common.h"
+
+// Reserved memory is committed in chunks of this many bytes
+#define HEAP_COMMIT_SIZE (1ul << 20)
+
+// Reserves address space without committing any memory to it.
+// Returns NULL if the address space isn't available.
+void* heap_reserve(u64 size);
+void heap_unreserve(void* base, u64 size);
+
+// Makes the pages covering [begin, end) readable and writable.
+// Returns false if the OS refuses to commit the memory.
+bool heap_commit(void* begin, void* end);
+
+// Returns the pages covering [begin, end) to the OS.
+// They must be committed again before they are touched.
+void heap_release(void* begin, void* end);
+
+#endif
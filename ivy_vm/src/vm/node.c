@@ -1,23 +1,27 @@
 
 #include "node.h"
+#include <inttypes.h>
 
 void dump_node(Node node) {
     if(NODE_IS_NIL(node)) {
         printf("NIL");
     } else if(NODE_IS_VAR(node)) {
-        printf("VAR %llu", NODE_GET_VAR_IDX(node));
+        printf("VAR %" PRIu64, NODE_GET_VAR_IDX(node));
     } else if(NODE_IS_CAL(node)) {
-        printf("CAL %llu", NODE_GET_CAL_IDX(node));
+        printf("CAL %" PRIu64, NODE_GET_CAL_IDX(node));
     } else if(NODE_IS_CON(node)) {
         Aux aux = NODE_GET_CON_AUX(node);
-        printf("CON %llu %llu", AUX_SIZE(aux), AUX_BEGIN(aux));
+        printf("CON %" PRIu64 " %" PRIu64, AUX_SIZE(aux), AUX_BEGIN(aux));
     } else if(NODE_IS_DUP(node)) {
         Aux aux = NODE_GET_DUP_AUX(node);
-        printf("DUP %llu %llu", AUX_SIZE(aux), AUX_BEGIN(aux));
+        printf("DUP %" PRIu64 " %" PRIu64, AUX_SIZE(aux), AUX_BEGIN(aux));
     } else if(NODE_IS_ERA(node)) {
         printf("ERA");
+    } else if(NODE_IS_SWI(node)) {
+        Aux aux = NODE_GET_SWI_AUX(node);
+        printf("SWI %" PRIu64 " %" PRIu64, AUX_SIZE(aux), AUX_BEGIN(aux));
     } else if(NODE_IS_SYM(node)) {
-        printf("SYM %llu", NODE_GET_SYM(node)); 
+        printf("SYM %" PRIu64, NODE_GET_SYM(node)); 
     } else {
         printf("TODO: node.c, dump_node.\n");
     }
@@ -29,6 +33,10 @@ Node make_var(u64 var) {
     return NODE_VAR(var);
 }
 
+Node make_cal(u64 def) {
+    return NODE_CAL(def);
+}
+
 Node make_con(Aux aux) {
     return NODE_CON(aux);
 }
@@ -37,6 +45,14 @@ Node make_dup(Aux aux) {
     return NODE_DUP(aux);
 }
 
+Node make_swi(Aux aux) {
+    return NODE_SWI(aux);
+}
+
+Node make_sym(u64 sym) {
+    return NODE_SYM(sym);
+}
+
 Node make_era() {
     return NODE_ERA;
 }
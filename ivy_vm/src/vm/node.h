@@ -63,7 +63,7 @@ typedef u64 Aux;
 #define NODE_IS_OPO(node)   (((node) & NODE_TAG_MASK) == NODE_OPO_TAG)
 
 #define NODE_SWI_TAG        (QNAN | NODE_F0 | NODE_F1 | NODE_F2)
-#define NODE_SWI(pair)      (NODE_SWI_TAG | (pair))
+#define NODE_SWI(aux)       (NODE_SWI_TAG | (aux))
 #define NODE_IS_SWI(node)   (((node) & NODE_TAG_MASK) == NODE_SWI_TAG)
 
 #define NODE_NIL ((u64)0xFFFFFFFFFFFFFFFF)
@@ -76,6 +76,7 @@ typedef u64 Aux;
 #define NODE_GET_OPI_OP(node)   ((node) & 0xFFFFFFFFFF)
 #define NODE_GET_OPI_IDX(node)  ((((node) & U48_MASK) >> 40) & 0xFF)
 #define NODE_GET_OPO_OP(node)   ((node) & U48_MASK)
+#define NODE_GET_SWI_AUX(node)  ((node) & U48_MASK)
 
 static inline u64 bitcast_f64_to_u64(f64 x) {
     union {
@@ -98,8 +99,20 @@ static inline f64 bitcast_u64_to_f64(u64 x) {
 #define NODE_SYM(sym)       ((sym) & U62_MASK)
 #define NODE_F64(num)       bitcast_f64_to_u64(num)
 #define NODE_IS_SYM(node)   (((node) & QNAN) != QNAN)
+// Erasers and numbers have no aux ports, two of them meeting does nothing
+#define NODE_IS_NULLARY(node) (NODE_IS_ERA(node) || NODE_IS_SYM(node))
 #define NODE_GET_SYM(node)  (node) 
 
+// Picks the branch a number selects out of n_branches.
+// Values in [i, i + 1) select branch i, anything else selects the last branch.
+static inline u64 switch_branch(Node value, u64 n_branches) {
+    f64 x = bitcast_u64_to_f64(value);
+    if(x >= 0.0 && x < (f64)(n_branches - 1)) {
+        return (u64)x;
+    }
+    return n_branches - 1;
+}
+
 typedef a64 ANode;
 typedef struct {
     ANode n0;
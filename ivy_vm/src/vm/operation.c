@@ -2,30 +2,282 @@
 #include "operation.h"
 #include "vm.h"
 
+// Four lanes of f64, the reductions below are written against GCC/Clang vector extensions
+// so they map to whatever SIMD the target has
+typedef f64 f64x4 __attribute__((vector_size(32)));
+typedef i64 i64x4 __attribute__((vector_size(32)));
+
+// Macros rather than functions, passing 32 byte vectors by value depends on the target's ABI
+#define LOAD_F64X4(v, nodes) memcpy(&(v), (nodes), sizeof(f64x4))
+#define SELECT_F64X4(mask, a, b) ((f64x4)((((i64x4)(a)) & (mask)) | (((i64x4)(b)) & ~(mask))))
+
+static inline f64 in_f64(Node* ins, u64 i) {
+    return bitcast_u64_to_f64(ins[i]);
+}
+
+static f64 reduce_add(Node* ins, u64 n_ins) {
+    f64x4 acc = {0.0, 0.0, 0.0, 0.0};
+    u64 i = 0;
+    for(; i + 4 <= n_ins; i += 4) {
+        f64x4 v;
+        LOAD_F64X4(v, &ins[i]);
+        acc += v;
+    }
+    f64 sum = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+    for(; i < n_ins; i++) {
+        sum += in_f64(ins, i);
+    }
+    return sum;
+}
+
+static f64 reduce_mul(Node* ins, u64 n_ins) {
+    f64x4 acc = {1.0, 1.0, 1.0, 1.0};
+    u64 i = 0;
+    for(; i + 4 <= n_ins; i += 4) {
+        f64x4 v;
+        LOAD_F64X4(v, &ins[i]);
+        acc *= v;
+    }
+    f64 product = (acc[0] * acc[1]) * (acc[2] * acc[3]);
+    for(; i < n_ins; i++) {
+        product *= in_f64(ins, i);
+    }
+    return product;
+}
+
+static f64 reduce_min(Node* ins, u64 n_ins) {
+    f64x4 acc = {INFINITY, INFINITY, INFINITY, INFINITY};
+    u64 i = 0;
+    for(; i + 4 <= n_ins; i += 4) {
+        f64x4 v;
+        LOAD_F64X4(v, &ins[i]);
+        acc = SELECT_F64X4(v < acc, v, acc);
+    }
+    f64 min = fmin(fmin(acc[0], acc[1]), fmin(acc[2], acc[3]));
+    for(; i < n_ins; i++) {
+        min = fmin(min, in_f64(ins, i));
+    }
+    return min;
+}
+
+static f64 reduce_max(Node* ins, u64 n_ins) {
+    f64x4 acc = {-INFINITY, -INFINITY, -INFINITY, -INFINITY};
+    u64 i = 0;
+    for(; i + 4 <= n_ins; i += 4) {
+        f64x4 v;
+        LOAD_F64X4(v, &ins[i]);
+        acc = SELECT_F64X4(v > acc, v, acc);
+    }
+    f64 max = fmax(fmax(acc[0], acc[1]), fmax(acc[2], acc[3]));
+    for(; i < n_ins; i++) {
+        max = fmax(max, in_f64(ins, i));
+    }
+    return max;
+}
+
+// Computes the result of a built-in or native operation from its inputs
+static inline Node compute_operation(u64 op, u64 n_ins, Node* ins) {
+    if(op & OP_NATIVE) {
+        Node (*func)(u64, Node*) = (void*)(op & ~OP_NATIVE);
+        return func(n_ins, ins);
+    }
+
+    #ifdef DEBUG_MODE
+    if(!OP_IS_VALID(op)) {
+        return NODE_ERA;
+    }
+    #endif
+
+    static const void* op_table[OP_COUNT] = {
+        &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_min, &&op_max,
+        &&op_eq,  &&op_ne,  &&op_lt,  &&op_le,  &&op_gt,  &&op_ge,
+        &&op_fma,
+        &&op_and, &&op_or,  &&op_xor, &&op_shl, &&op_shr
+    };
+
+    f64 acc;
+    u64 bits;
+    goto *op_table[op];
+
+    op_add:
+        return NODE_F64(reduce_add(ins, n_ins));
+    op_sub:
+        acc = in_f64(ins, 0);
+        for(u64 i = 1; i < n_ins; i++) {
+            acc -= in_f64(ins, i);
+        }
+        return NODE_F64(acc);
+    op_mul:
+        return NODE_F64(reduce_mul(ins, n_ins));
+    op_div:
+        acc = in_f64(ins, 0);
+        for(u64 i = 1; i < n_ins; i++) {
+            acc /= in_f64(ins, i);
+        }
+        return NODE_F64(acc);
+    op_min:
+        return NODE_F64(reduce_min(ins, n_ins));
+    op_max:
+        return NODE_F64(reduce_max(ins, n_ins));
+    op_eq:
+        return NODE_F64(n_ins >= 2 && in_f64(ins, 0) == in_f64(ins, 1) ? 1.0 : 0.0);
+    op_ne:
+        return NODE_F64(n_ins >= 2 && in_f64(ins, 0) != in_f64(ins, 1) ? 1.0 : 0.0);
+    op_lt:
+        return NODE_F64(n_ins >= 2 && in_f64(ins, 0) < in_f64(ins, 1) ? 1.0 : 0.0);
+    op_le:
+        return NODE_F64(n_ins >= 2 && in_f64(ins, 0) <= in_f64(ins, 1) ? 1.0 : 0.0);
+    op_gt:
+        return NODE_F64(n_ins >= 2 && in_f64(ins, 0) > in_f64(ins, 1) ? 1.0 : 0.0);
+    op_ge:
+        return NODE_F64(n_ins >= 2 && in_f64(ins, 0) >= in_f64(ins, 1) ? 1.0 : 0.0);
+    op_fma:
+        if(n_ins < 3) {
+            return NODE_F64(reduce_mul(ins, n_ins));
+        }
+        return NODE_F64(fma(in_f64(ins, 0), in_f64(ins, 1), in_f64(ins, 2)));
+    op_and:
+        bits = NODE_GET_SYM(ins[0]);
+        for(u64 i = 1; i < n_ins; i++) {
+            bits &= NODE_GET_SYM(ins[i]);
+        }
+        return NODE_SYM(bits);
+    op_or:
+        bits = NODE_GET_SYM(ins[0]);
+        for(u64 i = 1; i < n_ins; i++) {
+            bits |= NODE_GET_SYM(ins[i]);
+        }
+        return NODE_SYM(bits);
+    op_xor:
+        bits = NODE_GET_SYM(ins[0]);
+        for(u64 i = 1; i < n_ins; i++) {
+            bits ^= NODE_GET_SYM(ins[i]);
+        }
+        return NODE_SYM(bits);
+    op_shl:
+        bits = NODE_GET_SYM(ins[0]);
+        if(n_ins >= 2) {
+            bits <<= NODE_GET_SYM(ins[1]) & 63;
+        }
+        return NODE_SYM(bits);
+    op_shr:
+        bits = NODE_GET_SYM(ins[0]);
+        if(n_ins >= 2) {
+            bits >>= NODE_GET_SYM(ins[1]) & 63;
+        }
+        return NODE_SYM(bits);
+}
+
+Node compute_builtin(u64 op, u64 n_ins, Node* ins) {
+    return compute_operation(op, n_ins, ins);
+}
+
 void perform_operation(NetVM* vm, ThreadMem* mem, u64 op_idx) {
-    Node out;
     Operation* op = &vm->oper_buf[op_idx];
-    u64 n_ins = AUX_SIZE(op->ins);
-    Node* ins = get_aux(vm, op->ins);
-    if(op->killed) {
-        push_redx(vm, mem, NODE_ERA, op->out);
-        for(u64 i = 0; i < n_ins; i++) {
-            push_redx(vm, mem, NODE_ERA, ins[i]);
-        }
-    } else if(op->op == OP_ADD) {
-        f64 sum = 0.0;
-        for(u64 i = 0; i < n_ins; i++) {
-            sum += bitcast_u64_to_f64(ins[i]); 
+    u64 n_ins = op->n_ins;
+    Node* ins = oper_inputs(vm, op);
+    // A killed operation's ports were erased by the kill or on arrival, only the slot is left
+    if(!OPER_IS_KILLED(atomic_load_explicit(&op->n_unlinked, memory_order_relaxed))) {
+        push_redx(vm, mem, compute_operation(op->op, n_ins, ins), op->out);
+    }
+
+    if(n_ins > OPER_INLINE_INS) {
+        free_aux(vm, mem, op->ins_aux);
+    }
+    free_oper(vm, mem, op_idx);
+}
+
+// Built-in operations on two inputs are evaluated in sweeps over the whole batch.
+// Everything else is performed one at a time.
+static inline bool is_batchable(Operation* op) {
+    return op->op < OP_COUNT && op->op != OP_FMA && op->n_ins == 2 &&
+        !OPER_IS_KILLED(atomic_load_explicit(&op->n_unlinked, memory_order_relaxed));
+}
+
+#define SWEEP_F64(expr) \
+    for(u64 i = 0; i < n; i++) { \
+        f64 x = bitcast_u64_to_f64(lhs[i]); \
+        f64 y = bitcast_u64_to_f64(rhs[i]); \
+        res[i] = NODE_F64(expr); \
+    }
+
+#define SWEEP_SYM(expr) \
+    for(u64 i = 0; i < n; i++) { \
+        u64 x = NODE_GET_SYM(lhs[i]); \
+        u64 y = NODE_GET_SYM(rhs[i]); \
+        res[i] = NODE_SYM(expr); \
+    }
+
+static void sweep(u64 op, u64 n, Node* lhs, Node* rhs, Node* res) {
+    switch(op) {
+        case OP_ADD: SWEEP_F64(x + y); break;
+        case OP_SUB: SWEEP_F64(x - y); break;
+        case OP_MUL: SWEEP_F64(x * y); break;
+        case OP_DIV: SWEEP_F64(x / y); break;
+        case OP_MIN: SWEEP_F64(fmin(x, y)); break;
+        case OP_MAX: SWEEP_F64(fmax(x, y)); break;
+        case OP_EQ:  SWEEP_F64(x == y ? 1.0 : 0.0); break;
+        case OP_NE:  SWEEP_F64(x != y ? 1.0 : 0.0); break;
+        case OP_LT:  SWEEP_F64(x < y ? 1.0 : 0.0); break;
+        case OP_LE:  SWEEP_F64(x <= y ? 1.0 : 0.0); break;
+        case OP_GT:  SWEEP_F64(x > y ? 1.0 : 0.0); break;
+        case OP_GE:  SWEEP_F64(x >= y ? 1.0 : 0.0); break;
+        case OP_AND: SWEEP_SYM(x & y); break;
+        case OP_OR:  SWEEP_SYM(x | y); break;
+        case OP_XOR: SWEEP_SYM(x ^ y); break;
+        case OP_SHL: SWEEP_SYM(x << (y & 63)); break;
+        case OP_SHR: SWEEP_SYM(x >> (y & 63)); break;
+    }
+}
+
+// Performs a batch of ready operations, grouped by opcode.
+// Uses the thread's oper_scratch, which must hold 4 * n entries.
+void perform_operations(NetVM* vm, ThreadMem* mem, u64* op_idxs, u64 n) {
+    u64* sorted = mem->oper_scratch;
+    Node* lhs = &mem->oper_scratch[n];
+    Node* rhs = &mem->oper_scratch[2 * n];
+    Node* res = &mem->oper_scratch[3 * n];
+
+    // Counting sort by opcode, operations that can't be batched are performed right away
+    u64 counts[OP_COUNT + 1] = {0};
+    u64 n_batchable = 0;
+    for(u64 i = 0; i < n; i++) {
+        Operation* op = &vm->oper_buf[op_idxs[i]];
+        if(is_batchable(op)) {
+            counts[op->op + 1]++;
+            op_idxs[n_batchable++] = op_idxs[i];
+        } else {
+            perform_operation(vm, mem, op_idxs[i]);
         }
-        out = NODE_F64(sum);
-    } else if(op->op & (1ull << 63)) { // Native function
-        u64 func_ptr = op->op & (~(1ull << 63));
-        Node (*func)(u64, Node*) = (void*)func_ptr;
-        out = func(n_ins, ins);
+    }
+    for(u64 op = 0; op < OP_COUNT; op++) {
+        counts[op + 1] += counts[op];
+    }
+    for(u64 i = 0; i < n_batchable; i++) {
+        sorted[counts[vm->oper_buf[op_idxs[i]].op]++] = op_idxs[i];
     }
 
-    push_redx(vm, mem, out, op->out);
+    u64 begin = 0;
+    while(begin < n_batchable) {
+        u64 code = vm->oper_buf[sorted[begin]].op;
+        u64 end = begin;
+        while(end < n_batchable && vm->oper_buf[sorted[end]].op == code) {
+            // Two inputs always fit inline
+            Node* ins = vm->oper_buf[sorted[end]].ins;
+            lhs[end - begin] = ins[0];
+            rhs[end - begin] = ins[1];
+            end++;
+        }
 
-    free_aux(vm, mem, op->ins);
-    free_oper(vm, mem, op_idx);
-}
\ No newline at end of file
+        sweep(code, end - begin, lhs, rhs, res);
+
+        for(u64 i = begin; i < end; i++) {
+            Operation* op = &vm->oper_buf[sorted[i]];
+            push_redx(vm, mem, res[i - begin], op->out);
+            free_oper(vm, mem, sorted[i]);
+        }
+        begin = end;
+    }
+
+    mem->oper_batched += n_batchable;
+}
@@ -4,22 +4,84 @@
 
 #include "node.h"
 
-#define OP_ADD 0
+// Built-in operations.
+// ADD, MUL, MIN and MAX reduce over all of their inputs, SUB and DIV fold from the left.
+// Comparisons take two inputs and produce 1.0 or 0.0, FMA computes ins[0] * ins[1] + ins[2].
+// The bitwise operations work on the payload of SYM inputs and produce a SYM.
+#define OP_ADD   0
+#define OP_SUB   1
+#define OP_MUL   2
+#define OP_DIV   3
+#define OP_MIN   4
+#define OP_MAX   5
+#define OP_EQ    6
+#define OP_NE    7
+#define OP_LT    8
+#define OP_LE    9
+#define OP_GT    10
+#define OP_GE    11
+#define OP_FMA   12
+#define OP_AND   13
+#define OP_OR    14
+#define OP_XOR   15
+#define OP_SHL   16
+#define OP_SHR   17
+#define OP_COUNT 18
 
-typedef struct {
-    u64 op;
+// Operations with this bit set call the native function whose address is in the other bits
+#define OP_NATIVE (1ull << 63)
 
-    Aux  ins; 
-    Node out;
+// Ops are checked once when they enter a book, compute_operation trusts them
+#define OP_IS_VALID(op) (((op) & OP_NATIVE) || (op) < OP_COUNT)
+#define OPER_MAX_INS 256
+
+// Fewest inputs an operation can have. SUB, DIV and the bitwise operations start from ins[0],
+// comparisons and shifts need both sides. The reductions and FMA are defined on any number.
+static inline u32 op_min_ins(u64 op) {
+    if(op & OP_NATIVE) {
+        return 0;
+    }
+    switch(op) {
+        case OP_SUB: case OP_DIV: case OP_AND: case OP_OR: case OP_XOR:
+            return 1;
+        case OP_EQ: case OP_NE: case OP_LT: case OP_LE: case OP_GT: case OP_GE: case OP_SHL: case OP_SHR:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+// n_unlinked counts the ports that haven't been linked yet in its low 32 bits,
+// and how many erasers the operation met in its high 32 bits.
+// A single atomic add both records a kill and unlinks the killed port.
+#define OPER_UNLINKED_MASK 0xFFFFFFFFull
+#define OPER_KILL          (1ull << 32)
+#define OPER_IS_KILLED(n_unlinked) ((n_unlinked) >= OPER_KILL)
 
+// Operations with up to this many inputs keep them inline, wider ones in an aux block
+#define OPER_INLINE_INS 4
+
+// One cache line per operation, so threads linking ports of different operations don't share lines
+typedef struct {
+    _Alignas(64) u64 op;
     a64  n_unlinked;
 
-    bool killed;
+    // Ports that haven't been linked yet are NIL, all of them are ERA once the operation is killed
+    Node out;
+    u64  n_ins;
+    union {
+        Node ins[OPER_INLINE_INS];
+        Aux  ins_aux;
+    };
 } Operation;
 
+// Result of a built-in operation on the given inputs, used to fold operations at book time
+Node compute_builtin(u64 op, u64 n_ins, Node* ins);
+
 struct NetVM;
 struct ThreadMem;
 
 void perform_operation(struct NetVM* vm, struct ThreadMem* mem, u64 op_idx);
+void perform_operations(struct NetVM* vm, struct ThreadMem* mem, u64* op_idxs, u64 n);
 
 #endif
@@ -0,0 +1,579 @@
+
+#include "book.h"
+
+// Book time reduction.
+// Redexes whose outcome doesn't depend on anything outside the def are reduced once here
+// instead of once per instance: links, annihilations, erasures, switches on numbers and
+// built-in operations whose inputs are all numbers. Calls to defs that reduce to a number
+// or an eraser are replaced by it where the VM would expand them.
+// The rules are the VM's, applied to the def's own arrays.
+// Nodes that are used in ways the builders don't produce, like a var with three ends
+// or an aux block two nodes point at, are left alone.
+
+// Where a node sits in a def: an index into the aux buffer, a side of a redex or the output
+#define SLOT_REDX (1ull << 62)
+#define SLOT_OUT  (1ull << 63)
+#define SLOT_NONE UINT64_MAX
+
+// Whether an operation can still be folded
+enum {
+    FOLD_OPEN,
+    FOLD_STUCK,
+    FOLD_DONE
+};
+
+typedef struct {
+    Book* book;
+    Def* def;
+    BookOptStats* stats;
+
+    // Where the two ends of each var are, and how many ends were found (up to 3)
+    u64* var_slots;
+    u8*  var_uses;
+
+    // How many nodes point at the aux block starting at each index (up to 2)
+    u8* aux_refs;
+
+    // Where each operation's output is, and the redexes holding numbers for its inputs.
+    // The inputs of an operation start at ins_begin of it in ins_redx.
+    u64* opo_slots;
+    u64* ins_begin;
+    u64* ins_redx;
+    u32* n_ready;
+    u8*  fold;
+
+    // Redexes that may have become reducible
+    u64  work_len;
+    u64  work_cap;
+    u64* work;
+
+    // Set once the def has been changed, it is copied out of a book file first if it was mapped
+    bool changed;
+    bool failed;
+} DefOptimizer;
+
+static inline u64 n_slots(Def* def) {
+    return def->aux_len + 2 * def->redx_len + 1;
+}
+
+static inline u64 nth_slot(Def* def, u64 i) {
+    if(i < def->aux_len) {
+        return i;
+    }
+    if(i < def->aux_len + 2 * def->redx_len) {
+        return SLOT_REDX | (i - def->aux_len);
+    }
+    return SLOT_OUT;
+}
+
+static inline Node* slot_node(Def* def, u64 slot) {
+    if(slot & SLOT_OUT) {
+        return &def->out;
+    }
+    if(slot & SLOT_REDX) {
+        return &((Node*)def->redx_buf)[slot & ~SLOT_REDX];
+    }
+    return &def->aux_buf[slot];
+}
+
+static inline bool has_aux(Node node) {
+    return NODE_IS_CON(node) || NODE_IS_DUP(node) || NODE_IS_SWI(node);
+}
+
+// A def that reduces to a number or an eraser, which calls to it can be replaced by
+static inline bool is_constant(Def* def) {
+    return !def->failed && def->redx_len == 0 && NODE_IS_NULLARY(def->out);
+}
+
+// Called before anything is written to the def
+static inline bool begin_change(DefOptimizer* opt) {
+    if(!opt->changed) {
+        if(!def_modified(opt->def)) {
+            opt->failed = true;
+            return false;
+        }
+        opt->changed = true;
+    }
+    return true;
+}
+
+static void push_work(DefOptimizer* opt, u64 redx) {
+    if(!reserve((void**)&opt->work, &opt->work_cap, opt->work_len, 1, sizeof(u64))) {
+        opt->failed = true;
+        return;
+    }
+    opt->work[opt->work_len] = redx;
+    opt->work_len++;
+}
+
+// Writes a node to a slot, keeping track of where var ends and operation outputs went
+static void move_node(DefOptimizer* opt, Node node, u64 from, u64 to) {
+    Def* def = opt->def;
+    *slot_node(def, to) = node;
+    if(NODE_IS_VAR(node) && NODE_GET_VAR_IDX(node) < def->vars) {
+        u64* ends = &opt->var_slots[2 * NODE_GET_VAR_IDX(node)];
+        if(ends[0] == from) {
+            ends[0] = to;
+        } else if(ends[1] == from) {
+            ends[1] = to;
+        }
+    } else if(NODE_IS_OPO(node) && NODE_GET_OPO_OP(node) < def->oper_len) {
+        opt->opo_slots[NODE_GET_OPO_OP(node)] = to;
+    }
+    if(to & SLOT_REDX) {
+        push_work(opt, (to & ~SLOT_REDX) / 2);
+    }
+}
+
+static void add_redex(DefOptimizer* opt, Node a, u64 from_a, Node b, u64 from_b) {
+    Def* def = opt->def;
+    if(def->redx_len == DEF_MAX_REDX || !reserve((void**)&def->redx_buf, &def->redx_cap, def->redx_len, 1, sizeof(Pair))) {
+        opt->failed = true;
+        return;
+    }
+    u64 redx = def->redx_len;
+    def->redx_buf[redx] = MAKE_PAIR(NODE_NIL, NODE_NIL);
+    def->redx_len++;
+    move_node(opt, a, from_a, SLOT_REDX | (2 * redx));
+    move_node(opt, b, from_b, SLOT_REDX | (2 * redx + 1));
+}
+
+static inline void remove_redex(Def* def, u64 redx) {
+    def->redx_buf[redx] = MAKE_PAIR(NODE_NIL, NODE_NIL);
+}
+
+// A var whose two ends are both known
+static inline bool is_linkable(DefOptimizer* opt, Node node) {
+    return NODE_IS_VAR(node) && NODE_GET_VAR_IDX(node) < opt->def->vars && opt->var_uses[NODE_GET_VAR_IDX(node)] == 2;
+}
+
+// An aux block nothing else points at, so it can be taken apart
+static inline bool is_owned(DefOptimizer* opt, Node node) {
+    Aux aux = node & U48_MASK;
+    return AUX_BEGIN(aux) + AUX_SIZE(aux) <= opt->def->aux_len && opt->aux_refs[AUX_BEGIN(aux)] == 1;
+}
+
+// Redexes are reduced with the lower ranked node first, which is the order the rules below expect
+static inline u8 rank(DefOptimizer* opt, Node node) {
+    if(is_linkable(opt, node)) {
+        return 0;
+    } else if(NODE_IS_ERA(node)) {
+        return 1;
+    } else if(NODE_IS_SYM(node)) {
+        return 2;
+    } else if(NODE_IS_SWI(node)) {
+        return 3;
+    }
+    return 4;
+}
+
+static void fold_operation(DefOptimizer* opt, u64 op) {
+    Def* def = opt->def;
+    u64 n_ins = def->oper_ins[op];
+    Node ins[256];
+    for(u64 i = 0; i < n_ins; i++) {
+        Pair* redx = &def->redx_buf[opt->ins_redx[opt->ins_begin[op] + i]];
+        ins[i] = NODE_IS_OPI(redx->n0) ? redx->n1 : redx->n0;
+        *redx = MAKE_PAIR(NODE_NIL, NODE_NIL);
+    }
+    opt->fold[op] = FOLD_DONE;
+    opt->stats->oper_folded++;
+    move_node(opt, compute_builtin(def->oper_ops[op], n_ins, ins), SLOT_NONE, opt->opo_slots[op]);
+}
+
+// A number met an input of an operation, once all of them have one the operation is folded
+static void ready_input(DefOptimizer* opt, u64 redx, Node opi) {
+    u64 op = NODE_GET_OPI_OP(opi);
+    if(op >= opt->def->oper_len || opt->fold[op] != FOLD_OPEN) {
+        return;
+    }
+    u64* in = &opt->ins_redx[opt->ins_begin[op] + NODE_GET_OPI_IDX(opi)];
+    if(*in == redx) {
+        return;
+    }
+    if(*in != SLOT_NONE) {
+        opt->fold[op] = FOLD_STUCK;
+        return;
+    }
+    *in = redx;
+    opt->n_ready[op]++;
+    if(opt->n_ready[op] == opt->def->oper_ins[op] && begin_change(opt)) {
+        fold_operation(opt, op);
+    }
+}
+
+// A call the VM would expand, meeting something other than a var or an eraser, is replaced by the
+// def's output if the def is constant. Calls that never meet anything are kept, like the VM keeps them.
+static Node inline_call(DefOptimizer* opt, Node node, u64 slot, Node other) {
+    Book* book = opt->book;
+    if(!NODE_IS_CAL(node) || NODE_IS_VAR(other) || NODE_IS_ERA(other) || NODE_GET_CAL_IDX(node) >= book->defs_len
+        || !is_constant(book->defs[NODE_GET_CAL_IDX(node)]) || !begin_change(opt)) {
+        return node;
+    }
+    node = book->defs[NODE_GET_CAL_IDX(node)]->out;
+    *slot_node(opt->def, slot) = node;
+    opt->stats->calls_inlined++;
+    return node;
+}
+
+static void reduce_redex(DefOptimizer* opt, u64 redx) {
+    Def* def = opt->def;
+    Node a = def->redx_buf[redx].n0;
+    Node b = def->redx_buf[redx].n1;
+    u64 slot_a = SLOT_REDX | (2 * redx);
+    u64 slot_b = SLOT_REDX | (2 * redx + 1);
+    if(NODE_IS_NIL(a)) {
+        return;
+    }
+
+    a = inline_call(opt, a, slot_a, b);
+    b = inline_call(opt, b, slot_b, a);
+
+    if(rank(opt, b) < rank(opt, a)) {
+        swap_nodes(&a, &b);
+        u64 slot = slot_a;
+        slot_a = slot_b;
+        slot_b = slot;
+    }
+
+    if(is_linkable(opt, a)) {
+        // LINK, whatever is at the other end of the var takes b's place
+        if(a == b || !begin_change(opt)) {
+            return;
+        }
+        u64* ends = &opt->var_slots[2 * NODE_GET_VAR_IDX(a)];
+        u64 other = ends[0] == slot_a ? ends[1] : ends[0];
+        opt->var_uses[NODE_GET_VAR_IDX(a)] = 0;
+        remove_redex(def, redx);
+        move_node(opt, b, slot_b, other);
+    } else if(NODE_IS_NULLARY(a) && (NODE_IS_NULLARY(b) || (NODE_IS_ERA(a) && NODE_IS_CAL(b)))) {
+        // VOID
+        if(!begin_change(opt)) {
+            return;
+        }
+        remove_redex(def, redx);
+    } else if(((NODE_IS_CON(a) && NODE_IS_CON(b)) || (NODE_IS_DUP(a) && NODE_IS_DUP(b)))
+        && AUX_SIZE(a & U48_MASK) == AUX_SIZE(b & U48_MASK) && is_owned(opt, a) && is_owned(opt, b)) {
+        // ANNI
+        if(!begin_change(opt)) {
+            return;
+        }
+        remove_redex(def, redx);
+        u64 begin_a = AUX_BEGIN(a & U48_MASK);
+        u64 begin_b = AUX_BEGIN(b & U48_MASK);
+        for(u64 i = 0; i < AUX_SIZE(a & U48_MASK) && !opt->failed; i++) {
+            add_redex(opt, def->aux_buf[begin_a + i], begin_a + i, def->aux_buf[begin_b + i], begin_b + i);
+        }
+    } else if(NODE_IS_NULLARY(a) && (NODE_IS_CON(b) || NODE_IS_DUP(b) || (NODE_IS_ERA(a) && NODE_IS_SWI(b))) && is_owned(opt, b)) {
+        // ERAS, the eraser or number is copied into every aux port
+        if(!begin_change(opt)) {
+            return;
+        }
+        remove_redex(def, redx);
+        u64 begin = AUX_BEGIN(b & U48_MASK);
+        for(u64 i = 0; i < AUX_SIZE(b & U48_MASK) && !opt->failed; i++) {
+            if(!NODE_IS_NULLARY(def->aux_buf[begin + i])) {
+                add_redex(opt, def->aux_buf[begin + i], begin + i, a, SLOT_NONE);
+            }
+        }
+    } else if(NODE_IS_SYM(a) && NODE_IS_SWI(b) && AUX_SIZE(b & U48_MASK) >= 2 && is_owned(opt, b)) {
+        // SWIT, the selected branch is connected to the output and the others are erased.
+        // Switches without branches are left for the VM to reject.
+        if(!begin_change(opt)) {
+            return;
+        }
+        remove_redex(def, redx);
+        u64 begin = AUX_BEGIN(b & U48_MASK);
+        u64 size = AUX_SIZE(b & U48_MASK);
+        u64 idx = 1 + switch_branch(a, size - 1);
+        add_redex(opt, def->aux_buf[begin], begin, def->aux_buf[begin + idx], begin + idx);
+        for(u64 i = 1; i < size && !opt->failed; i++) {
+            if(i != idx && !NODE_IS_NULLARY(def->aux_buf[begin + i])) {
+                add_redex(opt, NODE_ERA, SLOT_NONE, def->aux_buf[begin + i], begin + i);
+            }
+        }
+    } else if(NODE_IS_SYM(a) && NODE_IS_OPI(b)) {
+        ready_input(opt, redx, b);
+    }
+}
+
+// Records where the tracked nodes of the def are
+static void scan_def(DefOptimizer* opt) {
+    Def* def = opt->def;
+    u32* opi_uses = calloc(def->oper_len + 1, sizeof(u32));
+    u32* opo_uses = calloc(def->oper_len + 1, sizeof(u32));
+    if(opi_uses == NULL || opo_uses == NULL) {
+        opt->failed = true;
+        free(opi_uses);
+        free(opo_uses);
+        return;
+    }
+
+    for(u64 i = 0; i < n_slots(def); i++) {
+        u64 slot = nth_slot(def, i);
+        Node node = *slot_node(def, slot);
+        if(NODE_IS_VAR(node) && NODE_GET_VAR_IDX(node) < def->vars) {
+            u64 var = NODE_GET_VAR_IDX(node);
+            if(opt->var_uses[var] < 2) {
+                opt->var_slots[2 * var + opt->var_uses[var]] = slot;
+            }
+            if(opt->var_uses[var] < 3) {
+                opt->var_uses[var]++;
+            }
+        } else if(has_aux(node)) {
+            u64 begin = AUX_BEGIN(node & U48_MASK);
+            if(begin < def->aux_len && opt->aux_refs[begin] < 2) {
+                opt->aux_refs[begin]++;
+            }
+        } else if(NODE_IS_OPI(node) && NODE_GET_OPI_OP(node) < def->oper_len) {
+            u64 op = NODE_GET_OPI_OP(node);
+            opi_uses[op]++;
+            if(NODE_GET_OPI_IDX(node) >= def->oper_ins[op]) {
+                opt->fold[op] = FOLD_STUCK;
+            }
+        } else if(NODE_IS_OPO(node) && NODE_GET_OPO_OP(node) < def->oper_len) {
+            opt->opo_slots[NODE_GET_OPO_OP(node)] = slot;
+            opo_uses[NODE_GET_OPO_OP(node)]++;
+        }
+    }
+
+    // Native operations may have side effects, so they're always left for the run
+    for(u64 op = 0; op < def->oper_len; op++) {
+        if(def->oper_ops[op] >= OP_COUNT || def->oper_ins[op] == 0 || opi_uses[op] != def->oper_ins[op] || opo_uses[op] != 1) {
+            opt->fold[op] = FOLD_STUCK;
+        }
+    }
+
+    free(opi_uses);
+    free(opo_uses);
+}
+
+// The nodes compact_def renumbers: the redexes, then the output, then the aux nodes copied so far
+static inline Node* compact_node(Def* def, Node* aux_buf, u64 redx_len, u64 i) {
+    if(i < 2 * redx_len) {
+        return &((Node*)def->redx_buf)[i];
+    }
+    if(i == 2 * redx_len) {
+        return &def->out;
+    }
+    return &aux_buf[i - 2 * redx_len - 1];
+}
+
+// Rebuilds the def from what's still reachable from its redexes and output,
+// dropping reduced redexes, folded operations, unused vars and aux blocks nothing points at
+static void compact_def(DefOptimizer* opt) {
+    Def* def = opt->def;
+
+    u64* var_map = malloc(sizeof(u64) * def->vars + 1);
+    u64* oper_map = malloc(sizeof(u64) * def->oper_len + 1);
+    u64* aux_map = malloc(sizeof(u64) * def->aux_len + 1);
+    u64 aux_cap = 0;
+    Node* aux_buf = NULL;
+    if(var_map == NULL || oper_map == NULL || aux_map == NULL) {
+        opt->failed = true;
+        goto done;
+    }
+    memset(var_map, 0xFF, sizeof(u64) * def->vars);
+    memset(aux_map, 0xFF, sizeof(u64) * def->aux_len);
+
+    u64 oper_len = 0;
+    for(u64 op = 0; op < def->oper_len; op++) {
+        if(opt->fold[op] != FOLD_DONE) {
+            oper_map[op] = oper_len;
+            def->oper_ops[oper_len] = def->oper_ops[op];
+            def->oper_ins[oper_len] = def->oper_ins[op];
+            oper_len++;
+        }
+    }
+
+    u64 redx_len = 0;
+    for(u64 i = 0; i < def->redx_len; i++) {
+        if(!NODE_IS_NIL(def->redx_buf[i].n0)) {
+            def->redx_buf[redx_len] = def->redx_buf[i];
+            redx_len++;
+        }
+    }
+
+    // Roots are renumbered first, then the blocks they reach in the order they were copied
+    u64 vars = 0;
+    u64 aux_len = 0;
+    u64 n_roots = 2 * redx_len + 1;
+    for(u64 i = 0; i < n_roots + aux_len && !opt->failed; i++) {
+        Node* node = compact_node(def, aux_buf, redx_len, i);
+        if(NODE_IS_VAR(*node) && NODE_GET_VAR_IDX(*node) < def->vars) {
+            u64 var = NODE_GET_VAR_IDX(*node);
+            if(var_map[var] == SLOT_NONE) {
+                var_map[var] = vars;
+                vars++;
+            }
+            *node = NODE_VAR(var_map[var]);
+        } else if(has_aux(*node) && AUX_BEGIN(*node & U48_MASK) + AUX_SIZE(*node & U48_MASK) <= def->aux_len) {
+            Aux aux = *node & U48_MASK;
+            u64 begin = AUX_BEGIN(aux);
+            if(aux_map[begin] == SLOT_NONE) {
+                u64 size = AUX_SIZE(aux);
+                if(!reserve((void**)&aux_buf, &aux_cap, aux_len, size, sizeof(Node))) {
+                    opt->failed = true;
+                    break;
+                }
+                // Growing the buffer may have moved the node being rewritten
+                node = compact_node(def, aux_buf, redx_len, i);
+                memcpy(&aux_buf[aux_len], &def->aux_buf[begin], sizeof(Node) * size);
+                aux_map[begin] = aux_len;
+                aux_len += size;
+            }
+            *node = (*node & NODE_TAG_MASK) | MAKE_AUX(AUX_SIZE(aux), aux_map[begin]);
+        } else if(NODE_IS_OPI(*node) && NODE_GET_OPI_OP(*node) < def->oper_len) {
+            *node = NODE_OPI(oper_map[NODE_GET_OPI_OP(*node)], NODE_GET_OPI_IDX(*node));
+        } else if(NODE_IS_OPO(*node) && NODE_GET_OPO_OP(*node) < def->oper_len) {
+            *node = NODE_OPO(oper_map[NODE_GET_OPO_OP(*node)]);
+        }
+    }
+    if(opt->failed) {
+        goto done;
+    }
+
+    free(def->aux_buf);
+    def->aux_buf = aux_buf;
+    def->aux_cap = aux_cap;
+    def->aux_len = aux_len;
+    def->redx_len = redx_len;
+    def->oper_len = oper_len;
+    def->vars = vars;
+    aux_buf = NULL;
+
+done:
+    free(var_map);
+    free(oper_map);
+    free(aux_map);
+    free(aux_buf);
+}
+
+static void free_optimizer(DefOptimizer* opt) {
+    free(opt->var_slots);
+    free(opt->var_uses);
+    free(opt->aux_refs);
+    free(opt->opo_slots);
+    free(opt->ins_begin);
+    free(opt->ins_redx);
+    free(opt->n_ready);
+    free(opt->fold);
+    free(opt->work);
+}
+
+static void optimize_def(Book* book, Def* def, BookOptStats* stats) {
+    if(def->failed) {
+        return;
+    }
+    stats->redx_before += def->redx_len;
+    stats->aux_before += def->aux_len;
+    stats->vars_before += def->vars;
+
+    DefOptimizer opt = {0};
+    opt.book = book;
+    opt.def = def;
+    opt.stats = stats;
+
+    u64 n_ins = 0;
+    for(u64 op = 0; op < def->oper_len; op++) {
+        n_ins += def->oper_ins[op];
+    }
+    opt.var_slots = malloc(sizeof(u64) * 2 * def->vars + 1);
+    opt.var_uses = calloc(def->vars + 1, sizeof(u8));
+    opt.aux_refs = calloc(def->aux_len + 1, sizeof(u8));
+    opt.opo_slots = malloc(sizeof(u64) * def->oper_len + 1);
+    opt.ins_begin = malloc(sizeof(u64) * def->oper_len + 1);
+    opt.ins_redx = malloc(sizeof(u64) * n_ins + 1);
+    opt.n_ready = calloc(def->oper_len + 1, sizeof(u32));
+    opt.fold = calloc(def->oper_len + 1, sizeof(u8));
+    if(opt.var_slots == NULL || opt.var_uses == NULL || opt.aux_refs == NULL || opt.opo_slots == NULL
+        || opt.ins_begin == NULL || opt.ins_redx == NULL || opt.n_ready == NULL || opt.fold == NULL) {
+        opt.failed = true;
+    } else {
+        memset(opt.var_slots, 0xFF, sizeof(u64) * 2 * def->vars);
+        memset(opt.ins_redx, 0xFF, sizeof(u64) * n_ins);
+        for(u64 op = 0, begin = 0; op < def->oper_len; op++) {
+            opt.ins_begin[op] = begin;
+            begin += def->oper_ins[op];
+        }
+        scan_def(&opt);
+    }
+
+    for(u64 i = def->redx_len; i > 0 && !opt.failed; i--) {
+        push_work(&opt, i - 1);
+    }
+    while(opt.work_len > 0 && !opt.failed) {
+        opt.work_len--;
+        reduce_redex(&opt, opt.work[opt.work_len]);
+    }
+
+    if(opt.changed && !opt.failed) {
+        compact_def(&opt);
+    }
+    if(opt.failed) {
+        def->failed = true;
+    }
+    free_optimizer(&opt);
+
+    stats->redx_after += def->redx_len;
+    stats->aux_after += def->aux_len;
+    stats->vars_after += def->vars;
+}
+
+// Defs are optimized after the defs they call, so calls to defs that fold down to a constant can be replaced.
+// Calls that loop back to a def being optimized are left as they are.
+void book_optimize(Book* book, BookOptStats* stats) {
+    memset(stats, 0, sizeof(BookOptStats));
+    if(book->failed) {
+        return;
+    }
+
+    enum { DEF_NEW, DEF_OPEN, DEF_DONE };
+    u8* state = calloc(book->defs_len + 1, sizeof(u8));
+    // Each entry of the stack is a def and how far its nodes have been searched for calls
+    u64* stack = malloc(sizeof(u64) * 2 * book->defs_len + 1);
+    if(state == NULL || stack == NULL) {
+        book->failed = true;
+        free(state);
+        free(stack);
+        return;
+    }
+
+    for(u64 root = 0; root < book->defs_len; root++) {
+        if(state[root] != DEF_NEW) {
+            continue;
+        }
+        u64 stack_len = 0;
+        stack[0] = root;
+        stack[1] = 0;
+        stack_len++;
+        state[root] = DEF_OPEN;
+
+        while(stack_len > 0) {
+            u64* top = &stack[2 * (stack_len - 1)];
+            Def* def = book->defs[top[0]];
+            u64 end = def->failed ? 0 : n_slots(def);
+            u64 callee = BOOK_MAX_DEF;
+            while(top[1] < end && callee == BOOK_MAX_DEF) {
+                Node node = *slot_node(def, nth_slot(def, top[1]));
+                top[1]++;
+                if(NODE_IS_CAL(node) && NODE_GET_CAL_IDX(node) < book->defs_len && state[NODE_GET_CAL_IDX(node)] == DEF_NEW) {
+                    callee = NODE_GET_CAL_IDX(node);
+                }
+            }
+            if(callee != BOOK_MAX_DEF) {
+                state[callee] = DEF_OPEN;
+                stack[2 * stack_len] = callee;
+                stack[2 * stack_len + 1] = 0;
+                stack_len++;
+            } else {
+                optimize_def(book, def, stats);
+                state[top[0]] = DEF_DONE;
+                stack_len--;
+            }
+        }
+    }
+
+    free(state);
+    free(stack);
+}
@@ -3,22 +3,141 @@
 #include "book.h"
 #include <time.h>
 
-void run(Book* book) {
+// Creates a VM that can run any number of books. Returns NULL if its memory can't be reserved.
+NetVM* vm_create(VMConfig* config) {
+    NetVM* vm = malloc(sizeof(NetVM));
+    if(vm == NULL) {
+        return NULL;
+    }
+    if(!vm_init(vm, config)) {
+        vm_destroy(vm);
+        free(vm);
+        return NULL;
+    }
+    return vm;
+}
+
+void vm_free(NetVM* vm) {
+    vm_destroy(vm);
+    free(vm);
+}
+
+// Reduces the net of the book's first def, leaving the VM ready for the next book.
+// Its normal form is written to output and statistics about the run to stats,
+// the caller releases them with free_readback and free_stats.
+// If the run fails, the stats describe the run up to the failure and output is left empty.
+VMError vm_eval(NetVM* vm, Book* book, VMStats* stats, Readback* output) {
+
+    memset(stats, 0, sizeof(VMStats));
+    memset(output, 0, sizeof(Readback));
+    if(book->defs_len == 0) {
+        return (VMError){ .code = VM_OK, .tid = 0 };
+    }
+    if(!book_finalize(book)) {
+        return (VMError){ .code = VM_ERR_BOOK, .tid = 0 };
+    }
+
+    vm_reset(vm);
+    if(!vm_set_book(vm, book)) {
+        return (VMError){ .code = VM_ERR_OUT_OF_MEMORY, .tid = 0 };
+    }
+
+    // A small root instance is made on this thread on behalf of thread 0.
+    // A large one is split between the workers, each putting its share into its own segments and deque,
+    // so the run starts out balanced. That happens inside vm_run and is timed with it.
+    ThreadMem* mem = &vm->threads[0];
+    if(setjmp(mem->fail_jmp) != 0) {
+        vm_collect_stats(vm, stats);
+        return vm_error(vm);
+    }
+    u64 out_var_idx = alloc_var(vm, mem);
+    Def* entry = book->defs[0];
+    if(vm->n_threads > 1 && entry->redx_len + entry->tmpl_aux_len >= ENTRY_SPLIT_MIN) {
+        vm->entry_def = entry;
+        vm->entry_out_var = out_var_idx;
+        atomic_store_explicit(&vm->entry_arrived[0], 0, memory_order_relaxed);
+        atomic_store_explicit(&vm->entry_arrived[1], 0, memory_order_relaxed);
+    } else {
+        Node out = instance_def(vm, mem, entry);
+        push_redx(vm, mem, NODE_VAR(out_var_idx), out);
+    }
+
+    // Wall-clock time, CPU time would add up the time of every thread
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool started = vm_run(vm);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    vm->entry_def = NULL;
+    if(!started) {
+        return (VMError){ .code = VM_ERR_THREAD, .tid = 0 };
+    }
+    f64 time_taken = (f64)(end.tv_sec - start.tv_sec) + (f64)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+    vm_collect_stats(vm, stats);
+    stats->time_taken = time_taken;
+
+    VMError error = vm_error(vm);
+    if(error.code != VM_OK) {
+        return error;
+    }
+    if(!vm_readback(vm, NODE_VAR(out_var_idx), output)) {
+        return (VMError){ .code = VM_ERR_OUT_OF_MEMORY, .tid = 0 };
+    }
+    return error;
+}
+
+// Runs a single book on a VM of its own
+VMError run(Book* book, VMConfig* config, VMStats* stats, Readback* output) {
+    NetVM* vm = vm_create(config);
+    if(vm == NULL) {
+        memset(stats, 0, sizeof(VMStats));
+        memset(output, 0, sizeof(Readback));
+        return (VMError){ .code = VM_ERR_OUT_OF_MEMORY, .tid = 0 };
+    }
+    VMError error = vm_eval(vm, book, stats, output);
+    vm_free(vm);
+    return error;
+}
+
+// Instances a def `count` times on a single thread without reducing anything.
+// Returns the number of instances created per second.
+f64 bench_instance_def(Book* book, u64 def_id, u64 count) {
+    if(!book_finalize(book)) {
+        return 0.0;
+    }
 
+    VMConfig config = { .n_threads = 1, .pin = PIN_NONE };
     NetVM* vm = malloc(sizeof(NetVM));
-    vm_init(vm);
+    if(vm == NULL) {
+        return 0.0;
+    }
+    if(!vm_init(vm, &config) || !vm_set_book(vm, book)) {
+        vm_destroy(vm);
+        free(vm);
+        return 0.0;
+    }
 
-    u64 out_var_idx = alloc_var(vm, &vm->threads[0]);
-    Node out = instance_def(vm, &vm->threads[0], book, &book->defs[0]);
-    push_redx(vm, &vm->threads[0], NODE_VAR(out_var_idx), out);
+    ThreadMem* mem = &vm->threads[0];
+    Def* def = book->defs[def_id];
+    if(setjmp(mem->fail_jmp) != 0) {
+        // Ran out of space before making all the instances
+        vm_destroy(vm);
+        free(vm);
+        return 0.0;
+    }
 
-    time_t start = clock();
-    vm_run(vm);
-    time_t end = clock();
-    f64 time_taken = (f64)(end - start) / (f64)CLOCKS_PER_SEC;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(u64 i = 0; i < count; i++) {
+        instance_def(vm, mem, def);
+        // The redexes are dropped, only the cost of instancing is measured
+        mem->prdx_put = 0;
+        atomic_store_explicit(&mem->redx_bot, atomic_load_explicit(&mem->redx_top, memory_order_relaxed), memory_order_relaxed);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    f64 time_taken = (f64)(end.tv_sec - start.tv_sec) + (f64)(end.tv_nsec - start.tv_nsec) / 1e9;
 
-    u64 interactions = atomic_load_explicit(&vm->interactions, memory_order_relaxed);
-    printf("INTERACTIONS: %llu\n", interactions);
-    printf("TIME TAKEN: %g\n", time_taken);
-    printf("MIPS: %g\n", (f64)interactions / time_taken / 1000000.0);
+    vm_destroy(vm);
+    free(vm);
+    return (f64)count / time_taken;
 }
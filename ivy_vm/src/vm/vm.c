@@ -4,62 +4,556 @@
 
 #define INITIAL_PAIR_CAPACITY 128
 
-void vm_init(NetVM* vm) {
-    atomic_store_explicit(&vm->interactions, 0, memory_order_relaxed);
+static inline u64 floor_pow2(u64 x) {
+    return 1ull << (63 - __builtin_clzll(x));
+}
+
+// Unreserves the rings that grew past the end of the thread's redex segment
+static void release_redx_overflow(ThreadMem* mem) {
+    for(u32 i = 0; i < mem->redx_n_rings; i++) {
+        RedxRing* ring = &mem->redx_rings[i];
+        if(ring->reserved != 0) {
+            heap_unreserve(ring->buf, ring->reserved);
+            ring->reserved = 0;
+        }
+    }
+}
+
+// The end of the part of the redex segment that has been committed
+static APair* redx_segment_end(ThreadMem* mem) {
+    APair* end = mem->redx_base;
+    for(u32 i = 0; i < mem->redx_n_rings; i++) {
+        RedxRing* ring = &mem->redx_rings[i];
+        if(ring->reserved == 0 && ring->buf + ring->mask + 1 > end) {
+            end = ring->buf + ring->mask + 1;
+        }
+    }
+    return end;
+}
+
+// How far a segment is committed once every element below `needed` is usable.
+// Memory is committed a chunk at a time so the slow path is rarely hit.
+static inline u64 commit_target(u64 elem_size, u64 needed, u64 last) {
+    u64 target = (needed * elem_size + HEAP_COMMIT_SIZE - 1) / HEAP_COMMIT_SIZE * HEAP_COMMIT_SIZE / elem_size;
+    return target > last ? last : target;
+}
+
+// Rewinds a thread's allocators and bags to the start of its segments
+static void reset_thread(NetVM* vm, ThreadMem* mem) {
+    u64 tid = mem->tid;
+
+    mem->aux_curr = tid * vm->aux_block_size;
+    mem->aux_commit = mem->aux_curr;
+    mem->aux_last = (tid + 1) * vm->aux_block_size;
+    for(u32 i = 0; i < 256; i++) {
+        mem->aux_free[i] = UINT64_MAX;
+        atomic_store_explicit(&mem->remote_aux_free[i], UINT64_MAX, memory_order_relaxed);
+    }
+    for(u32 i = 0; i < SLAB_MAX_SIZE; i++) {
+        mem->slab_partial[i] = SLAB_NONE;
+    }
+    mem->slab_empty = SLAB_NONE;
+    mem->aux_run_curr = mem->aux_curr;
+    mem->aux_run_end = mem->aux_curr;
+
+    mem->var_curr = tid * vm->var_block_size;
+    mem->var_commit = mem->var_curr;
+    mem->var_end = mem->var_curr;
+    mem->var_last = (tid + 1) * vm->var_block_size;
+    mem->var_free = UINT64_MAX;
+    atomic_store_explicit(&mem->remote_var_free, UINT64_MAX, memory_order_relaxed);
+
+    mem->redx_base = &vm->redx_buf[tid * vm->redx_block_size];
+    mem->redx_rings[0] = (RedxRing){
+        .buf = mem->redx_base,
+        .mask = (1ul << REDX_RING_MIN_POW2) - 1,
+        .reserved = 0
+    };
+    mem->redx_n_rings = 1;
+    atomic_store_explicit(&mem->redx_ring, &mem->redx_rings[0], memory_order_relaxed);
+    atomic_store_explicit(&mem->redx_top, 0, memory_order_relaxed);
+    atomic_store_explicit(&mem->redx_bot, 0, memory_order_relaxed);
+
+    mem->oper_curr = tid * vm->oper_block_size;
+    mem->oper_commit = mem->oper_curr;
+    mem->oper_last = (tid + 1) * vm->oper_block_size;
+    mem->oper_free = UINT64_MAX;
+    atomic_store_explicit(&mem->remote_oper_free, UINT64_MAX, memory_order_relaxed);
+
+    mem->oper_ready_len = 0;
+    mem->oper_batched = 0;
+
+    mem->prdx_put = 0;
+
+    mem->era_skipped = 0;
+    mem->budget = 0;
+
+    memset(mem->interactions, 0, sizeof(mem->interactions));
+
+    #ifdef VM_STATS
+    memset(mem->rule_counts, 0, sizeof(mem->rule_counts));
+    mem->redx_pushes = 0;
+    mem->prdx_pushes = 0;
+    mem->redx_peak = 0;
+    mem->prdx_peak = 0;
+    mem->oper_nsec = 0;
+    mem->remote_frees = 0;
+    #endif
+}
+
+// Clears the error and refills the quotas for the next run
+static void reset_quotas(NetVM* vm) {
+    atomic_store_explicit(&vm->error, VM_OK, memory_order_relaxed);
+    vm->error_tid = 0;
+    atomic_store_explicit(&vm->starved, 0, memory_order_relaxed);
+    atomic_store_explicit(&vm->interaction_quota, vm->limits.max_interactions == 0 ? UINT64_MAX : vm->limits.max_interactions, memory_order_relaxed);
+    atomic_store_explicit(&vm->aux_quota, vm->limits.max_aux == 0 ? UINT64_MAX : vm->limits.max_aux, memory_order_relaxed);
+    atomic_store_explicit(&vm->var_quota, vm->limits.max_vars == 0 ? UINT64_MAX : vm->limits.max_vars, memory_order_relaxed);
+}
+
+bool vm_init(NetVM* vm, VMConfig* config) {
+    atomic_store_explicit(&vm->idle, 0, memory_order_relaxed);
+
+    pthread_mutex_init(&vm->pool_lock, NULL);
+    pthread_cond_init(&vm->pool_wake, NULL);
+    pthread_cond_init(&vm->pool_done, NULL);
+    vm->pool_gen = 0;
+    vm->pool_busy = 0;
+    vm->pool_started = false;
+    vm->pool_stop = false;
+
+    u32 n_threads = config->n_threads;
+    if(n_threads == 0) {
+        n_threads = 1;
+    } else if(n_threads > VM_MAX_THREADS) {
+        n_threads = VM_MAX_THREADS;
+    }
+
+    vm->n_threads = n_threads;
+    vm->pin = config->pin;
+    vm->oper_batch = config->oper_batch == 0 ? OPER_BATCH_DEFAULT : config->oper_batch;
+    vm->limits = config->limits;
+    vm->readback_nodes = config->readback_nodes == 0 ? READBACK_MAX_NODES : config->readback_nodes;
+    reset_quotas(vm);
+    vm->entry_def = NULL;
+    vm->entry_vars = NULL;
+    vm->entry_oper = NULL;
+    vm->entry_aux = NULL;
+
+    vm->aux_buf = heap_reserve(sizeof(Node) * VM_MAX_AUX);
+    vm->aux_slabs = heap_reserve(sizeof(AuxSlab) * (VM_MAX_AUX / SLAB_NODES));
+    vm->var_buf = heap_reserve(sizeof(ANode) * VM_MAX_VAR);
+    vm->redx_buf = heap_reserve(sizeof(APair) * VM_MAX_REDX);
+    vm->oper_buf = heap_reserve(sizeof(Operation) * VM_MAX_OPER);
+    vm->threads = aligned_alloc(64, sizeof(ThreadMem) * n_threads);
+    if(vm->threads != NULL) {
+        memset(vm->threads, 0, sizeof(ThreadMem) * n_threads);
+    }
+    if(vm->aux_buf == NULL || vm->aux_slabs == NULL || vm->var_buf == NULL || vm->redx_buf == NULL || vm->oper_buf == NULL || vm->threads == NULL) {
+        return false;
+    }
+
+    // Segments are made of whole windows
+    vm->aux_block_size = VM_MAX_AUX / n_threads / SLAB_NODES * SLAB_NODES;
+    vm->var_block_size = VM_MAX_VAR / n_threads;
+    vm->redx_block_size = floor_pow2(VM_MAX_REDX / n_threads);
+    vm->oper_block_size = VM_MAX_OPER / n_threads;
+
+    for(u32 tid = 0; tid < n_threads; tid++) {
+        ThreadMem* mem = &vm->threads[tid];
+        mem->vm = vm;
+        mem->tid = tid;
+        mem->steal_seed = 0x9E3779B97F4A7C15ull * (tid + 1);
+        mem->instance_vars = NULL;
+        mem->instance_oper = NULL;
+        mem->instance_aux = NULL;
+        mem->oper_ready = malloc(sizeof(u64) * vm->oper_batch);
+        mem->oper_scratch = malloc(sizeof(u64) * 4 * vm->oper_batch);
+        if(mem->oper_ready == NULL || mem->oper_scratch == NULL) {
+            return false;
+        }
+        reset_thread(vm, mem);
+
+        RedxRing* ring = &mem->redx_rings[0];
+        if(!heap_commit(ring->buf, ring->buf + ring->mask + 1)) {
+            return false;
+        }
+    }
 
-    for(u64 tid = 0; tid < N_THREADS; tid++) {
-        vm->threads[tid] = (ThreadMem){
-            .tid = tid,
+    return true;
+}
 
-            .aux_curr = tid * AUX_BLOCK_SIZE,
-            .aux_last = (tid + 1) * AUX_BLOCK_SIZE,
+// Empties the VM for another run in O(threads).
+// Unlike vm_release the memory stays committed, so the next run doesn't fault it in again.
+void vm_reset(NetVM* vm) {
+    for(u32 tid = 0; tid < vm->n_threads; tid++) {
+        ThreadMem* mem = &vm->threads[tid];
+        u64 aux_commit = mem->aux_commit;
+        u64 var_commit = mem->var_commit;
+        u64 oper_commit = mem->oper_commit;
+        release_redx_overflow(mem);
+        reset_thread(vm, mem);
+        mem->aux_commit = aux_commit;
+        mem->var_commit = var_commit;
+        mem->oper_commit = oper_commit;
+    }
+    reset_quotas(vm);
+}
 
-            .var_curr = tid * VAR_BLOCK_SIZE,
-            .var_last = (tid + 1) * VAR_BLOCK_SIZE, 
-            .var_free = UINT64_MAX,
+// Gives all the memory committed during a run back to the OS, keeping the address space reserved.
+// The VM is left empty and can be run again.
+void vm_release(NetVM* vm) {
+    for(u32 tid = 0; tid < vm->n_threads; tid++) {
+        ThreadMem* mem = &vm->threads[tid];
+        u64 aux_begin = tid * vm->aux_block_size;
+        u64 var_begin = tid * vm->var_block_size;
+        u64 oper_begin = tid * vm->oper_block_size;
+
+        heap_release(&vm->aux_buf[aux_begin], &vm->aux_buf[mem->aux_commit]);
+        heap_release(&vm->aux_slabs[aux_begin / SLAB_NODES], &vm->aux_slabs[mem->aux_commit / SLAB_NODES]);
+        heap_release(&vm->var_buf[var_begin], &vm->var_buf[mem->var_commit]);
+        heap_release(&vm->oper_buf[oper_begin], &vm->oper_buf[mem->oper_commit]);
+        heap_release(mem->redx_base, redx_segment_end(mem));
+        release_redx_overflow(mem);
+    }
 
-            .redx_base = &vm->redx_buf[tid * REDX_BLOCK_SIZE],
-            .redx_put = 0,
+    for(u32 tid = 0; tid < vm->n_threads; tid++) {
+        ThreadMem* mem = &vm->threads[tid];
+        reset_thread(vm, mem);
+        RedxRing* ring = &mem->redx_rings[0];
+        heap_commit(ring->buf, ring->buf + ring->mask + 1);
+    }
+    reset_quotas(vm);
+}
+
+void vm_destroy(NetVM* vm) {
+    if(vm->pool_started) {
+        pthread_mutex_lock(&vm->pool_lock);
+        vm->pool_stop = true;
+        pthread_cond_broadcast(&vm->pool_wake);
+        pthread_mutex_unlock(&vm->pool_lock);
+        for(u32 tid = 0; tid < vm->n_threads; tid++) {
+            pthread_join(vm->threads[tid].thread, NULL);
+        }
+    }
+    pthread_mutex_destroy(&vm->pool_lock);
+    pthread_cond_destroy(&vm->pool_wake);
+    pthread_cond_destroy(&vm->pool_done);
+
+    if(vm->aux_buf != NULL) heap_unreserve(vm->aux_buf, sizeof(Node) * VM_MAX_AUX);
+    if(vm->aux_slabs != NULL) heap_unreserve(vm->aux_slabs, sizeof(AuxSlab) * (VM_MAX_AUX / SLAB_NODES));
+    if(vm->var_buf != NULL) heap_unreserve(vm->var_buf, sizeof(ANode) * VM_MAX_VAR);
+    if(vm->redx_buf != NULL) heap_unreserve(vm->redx_buf, sizeof(APair) * VM_MAX_REDX);
+    if(vm->oper_buf != NULL) heap_unreserve(vm->oper_buf, sizeof(Operation) * VM_MAX_OPER);
+    if(vm->threads != NULL) {
+        for(u32 tid = 0; tid < vm->n_threads; tid++) {
+            release_redx_overflow(&vm->threads[tid]);
+            free(vm->threads[tid].instance_vars);
+            free(vm->threads[tid].instance_oper);
+            free(vm->threads[tid].instance_aux);
+            free(vm->threads[tid].oper_ready);
+            free(vm->threads[tid].oper_scratch);
+        }
+        free(vm->threads);
+    }
+    free(vm->entry_vars);
+    free(vm->entry_oper);
+    free(vm->entry_aux);
+}
+
+// Sums the interaction counters of every thread. Only exact once vm_run has returned.
+void vm_rule_interactions(NetVM* vm, u64 counts[NODE_TABLE_SIZE][NODE_TABLE_SIZE]) {
+    memset(counts, 0, sizeof(u64) * NODE_TABLE_SIZE * NODE_TABLE_SIZE);
+    for(u32 tid = 0; tid < vm->n_threads; tid++) {
+        ThreadMem* mem = &vm->threads[tid];
+        for(u32 i = 0; i < NODE_TABLE_SIZE; i++) {
+            for(u32 j = 0; j < NODE_TABLE_SIZE; j++) {
+                counts[i][j] += mem->interactions[i][j];
+            }
+        }
+    }
+}
 
-            .oper_curr = tid * OPER_BLOCK_SIZE,
-            .oper_last = (tid + 1) * OPER_BLOCK_SIZE,
-            .oper_free = UINT64_MAX,
+u64 vm_interactions(NetVM* vm) {
+    u64 counts[NODE_TABLE_SIZE][NODE_TABLE_SIZE];
+    vm_rule_interactions(vm, counts);
+    u64 total = 0;
+    for(u32 i = 0; i < NODE_TABLE_SIZE; i++) {
+        for(u32 j = 0; j < NODE_TABLE_SIZE; j++) {
+            total += counts[i][j];
+        }
+    }
+    return total;
+}
 
-            .prdx_put = 0,
-            
-            .instance_vars = malloc(sizeof(u64) * DEF_MAX_VAR),
-            .instance_oper = malloc(sizeof(u64) * DEF_MAX_OPER)
-        };
+// Fills in everything but the time taken. Only exact once vm_run has returned.
+bool vm_collect_stats(NetVM* vm, VMStats* stats) {
+    memset(stats, 0, sizeof(VMStats));
+    stats->threads = calloc(vm->n_threads, sizeof(ThreadStats));
+    if(stats->threads == NULL) {
+        return false;
+    }
+    stats->n_threads = vm->n_threads;
+    #ifdef VM_STATS
+    stats->enabled = 1;
+    #endif
+
+    for(u32 tid = 0; tid < vm->n_threads; tid++) {
+        ThreadMem* mem = &vm->threads[tid];
+        ThreadStats* thread = &stats->threads[tid];
+        for(u32 i = 0; i < NODE_TABLE_SIZE; i++) {
+            for(u32 j = 0; j < NODE_TABLE_SIZE; j++) {
+                thread->interactions += mem->interactions[i][j];
+            }
+        }
+        thread->aux_peak = mem->aux_curr - tid * vm->aux_block_size;
+        thread->var_peak = mem->var_curr - tid * vm->var_block_size;
+        thread->oper_peak = mem->oper_curr - tid * vm->oper_block_size;
 
         for(u32 i = 0; i < 256; i++) {
-            vm->threads[tid].aux_free[i] = UINT64_MAX;
+            u64 heads[2] = { mem->aux_free[i], atomic_load_explicit(&mem->remote_aux_free[i], memory_order_relaxed) };
+            for(u32 j = 0; j < 2; j++) {
+                for(u64 block = heads[j]; block != UINT64_MAX; block = vm->aux_buf[block]) {
+                    thread->aux_free += i + 1;
+                }
+            }
+        }
+        for(u32 i = 0; i < SLAB_MAX_SIZE; i++) {
+            for(u32 w = mem->slab_partial[i]; w != SLAB_NONE; w = vm->aux_slabs[w].next) {
+                thread->aux_free += vm->aux_slabs[w].n_free * (i + 1);
+            }
+        }
+        for(u32 w = mem->slab_empty; w != SLAB_NONE; w = vm->aux_slabs[w].next) {
+            thread->aux_free += SLAB_NODES;
+        }
+        u64 var_heads[2] = { mem->var_free, atomic_load_explicit(&mem->remote_var_free, memory_order_relaxed) };
+        u64 oper_heads[2] = { mem->oper_free, atomic_load_explicit(&mem->remote_oper_free, memory_order_relaxed) };
+        for(u32 j = 0; j < 2; j++) {
+            for(u64 var = var_heads[j]; var != UINT64_MAX; var = atomic_load_explicit(&vm->var_buf[var], memory_order_relaxed)) {
+                thread->var_free++;
+            }
+            for(u64 oper = oper_heads[j]; oper != UINT64_MAX; oper = vm->oper_buf[oper].op) {
+                thread->oper_free++;
+            }
+        }
+
+        // What this run would have committed on a fresh VM. vm_reset keeps the pages of earlier runs
+        // committed, so the commit watermarks can be past anything this run used.
+        stats->peak_memory += sizeof(Node) * (commit_target(sizeof(Node), mem->aux_curr, mem->aux_last) - tid * vm->aux_block_size);
+        stats->peak_memory += sizeof(ANode) * (commit_target(sizeof(ANode), mem->var_end, mem->var_last) - tid * vm->var_block_size);
+        stats->peak_memory += sizeof(Operation) * (commit_target(sizeof(Operation), mem->oper_curr, mem->oper_last) - tid * vm->oper_block_size);
+        stats->peak_memory += sizeof(APair) * (redx_segment_end(mem) - mem->redx_base);
+        for(u32 i = 0; i < mem->redx_n_rings; i++) {
+            stats->peak_memory += mem->redx_rings[i].reserved;
+        }
+
+        stats->interactions += thread->interactions;
+        stats->era_skipped += mem->era_skipped;
+        stats->oper_batched += mem->oper_batched;
+
+        #ifdef VM_STATS
+        thread->redx_pushes = mem->redx_pushes;
+        thread->prdx_pushes = mem->prdx_pushes;
+        thread->redx_peak = mem->redx_peak;
+        thread->prdx_peak = mem->prdx_peak;
+        thread->remote_frees = mem->remote_frees;
+        thread->oper_time = (f64)mem->oper_nsec / 1e9;
+        for(u32 rule = 0; rule < RULE_COUNT; rule++) {
+            stats->rules[rule] += mem->rule_counts[rule];
+        }
+        #endif
+    }
+    return true;
+}
+
+void free_stats(VMStats* stats) {
+    free(stats->threads);
+    stats->threads = NULL;
+}
+
+// Parses a cpulist such as "0-3,8,10-11" into a cpu set
+static void parse_cpulist(const char* list, cpu_set_t* set) {
+    while(*list) {
+        char* end;
+        long first = strtol(list, &end, 10);
+        long last = first;
+        if(end == list) {
+            return;
+        }
+        if(*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+        }
+        for(long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, set);
+        }
+        list = *end == ',' ? end + 1 : end;
+    }
+}
+
+// Finds the cpus of the NUMA node that the worker should be pinned to.
+// Returns false if the system doesn't expose its NUMA topology.
+static bool get_node_cpus(u32 tid, cpu_set_t* set) {
+    u32 n_nodes = 0;
+    char path[64];
+    while(true) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", n_nodes);
+        FILE* file = fopen(path, "r");
+        if(file == NULL) {
+            break;
+        }
+        fclose(file);
+        n_nodes++;
+    }
+    if(n_nodes == 0) {
+        return false;
+    }
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", tid % n_nodes);
+    FILE* file = fopen(path, "r");
+    if(file == NULL) {
+        return false;
+    }
+    char list[4096];
+    bool ok = fgets(list, sizeof(list), file) != NULL;
+    fclose(file);
+    if(ok) {
+        CPU_ZERO(set);
+        parse_cpulist(list, set);
+    }
+    return ok;
+}
+
+// Pins the calling worker according to the VM's pin mode.
+// Pinning is best effort, workers simply stay unpinned if it fails.
+static void pin_thread(NetVM* vm, ThreadMem* mem) {
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(vm->pin == PIN_CORE) {
+        u32 n_cpus = CPU_COUNT(&allowed);
+        u32 target = mem->tid % n_cpus;
+        for(u32 cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if(CPU_ISSET(cpu, &allowed) && target-- == 0) {
+                CPU_SET(cpu, &set);
+                break;
+            }
+        }
+    } else if(vm->pin == PIN_NODE) {
+        if(!get_node_cpus(mem->tid, &set)) {
+            return;
+        }
+        CPU_AND(&set, &set, &allowed);
+    }
+
+    if(CPU_COUNT(&set) > 0) {
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+}
+
+// Waits for every worker to get here. Returns false if one of them failed instead.
+static bool entry_barrier(NetVM* vm, a32* arrived) {
+    atomic_fetch_add_explicit(arrived, 1, memory_order_acq_rel);
+    while(atomic_load_explicit(arrived, memory_order_acquire) < vm->n_threads) {
+        if(atomic_load_explicit(&vm->error, memory_order_relaxed) != VM_OK) {
+            return false;
         }
+        sched_yield();
+    }
+    return true;
+}
+
+// Instances the entry def together with the other workers, each one taking a share of it.
+// Nothing is reduced until the whole instance is in place, since any redex may point into any thread's share.
+// Returns false if a worker failed before the instance was complete.
+static bool instance_entry(NetVM* vm, ThreadMem* mem) {
+    entry_alloc(vm, mem, vm->entry_def);
+    if(!entry_barrier(vm, &vm->entry_arrived[0])) {
+        return false;
     }
+    Node out = entry_fill(vm, mem, vm->entry_def);
+    if(mem->tid == 0) {
+        push_redx(vm, mem, NODE_VAR(vm->entry_out_var), out);
+    }
+    return entry_barrier(vm, &vm->entry_arrived[1]);
 }
 
-typedef struct {
-    NetVM* vm;
-    ThreadMem* mem;
-} ThreadInfo;
+// A pooled worker. Sleeps until a run starts, reduces until the net is normal, and goes back to sleep.
+void* thread_func(void* param) {
+    ThreadMem* mem = (ThreadMem*)param;
+    NetVM* vm = mem->vm;
+    if(vm->pin != PIN_NONE) {
+        pin_thread(vm, mem);
+    }
+
+    u64 gen = 0;
+    pthread_mutex_lock(&vm->pool_lock);
+    while(true) {
+        while(vm->pool_gen == gen && !vm->pool_stop) {
+            pthread_cond_wait(&vm->pool_wake, &vm->pool_lock);
+        }
+        if(vm->pool_stop) {
+            break;
+        }
+        gen = vm->pool_gen;
+        pthread_mutex_unlock(&vm->pool_lock);
 
-void thread_func(void* param) {
-    ThreadInfo* info = (ThreadInfo*)param;
-    thread_run(info->vm, info->mem);
+        if(setjmp(mem->fail_jmp) == 0 && (vm->entry_def == NULL || instance_entry(vm, mem))) {
+            thread_run(vm, mem);
+        }
+
+        pthread_mutex_lock(&vm->pool_lock);
+        vm->pool_busy--;
+        if(vm->pool_busy == 0) {
+            pthread_cond_signal(&vm->pool_done);
+        }
+    }
+    pthread_mutex_unlock(&vm->pool_lock);
+    return NULL;
 }
 
-void vm_run(NetVM* vm) {
-    ThreadInfo thread_info[N_THREADS];
-    for(u32 tid = 0; tid < N_THREADS; tid++) {
-        thread_info[tid].vm = vm;
-        thread_info[tid].mem = &vm->threads[tid];
-        pthread_create(&vm->threads[tid].thread, NULL, thread_func, &thread_info[tid]);
+// Starts the workers. If one of them can't be started, the ones that were are stopped again
+// so the next run can try again.
+static bool start_pool(NetVM* vm) {
+    for(u32 tid = 0; tid < vm->n_threads; tid++) {
+        if(pthread_create(&vm->threads[tid].thread, NULL, thread_func, &vm->threads[tid]) != 0) {
+            pthread_mutex_lock(&vm->pool_lock);
+            vm->pool_stop = true;
+            pthread_cond_broadcast(&vm->pool_wake);
+            pthread_mutex_unlock(&vm->pool_lock);
+            for(u32 i = 0; i < tid; i++) {
+                pthread_join(vm->threads[i].thread, NULL);
+            }
+            vm->pool_stop = false;
+            return false;
+        }
     }
+    vm->pool_started = true;
+    return true;
+}
 
-    for(u32 tid = 0; tid < N_THREADS; tid++) {
-        pthread_join(vm->threads[tid].thread, NULL);
-        fflush(stdout);
+// Returns false if the workers couldn't be started, in which case nothing was reduced
+bool vm_run(NetVM* vm) {
+    if(!vm->pool_started && !start_pool(vm)) {
+        return false;
     }
 
+    pthread_mutex_lock(&vm->pool_lock);
+    atomic_store_explicit(&vm->idle, 0, memory_order_relaxed);
+    vm->pool_busy = vm->n_threads;
+    vm->pool_gen++;
+    pthread_cond_broadcast(&vm->pool_wake);
+    while(vm->pool_busy > 0) {
+        pthread_cond_wait(&vm->pool_done, &vm->pool_lock);
+    }
+    pthread_mutex_unlock(&vm->pool_lock);
+
+    fflush(stdout);
+    return true;
 }
 
 // Converts a node to its index in various tables.
@@ -88,52 +582,485 @@ static inline u8 get_node_table_index(Node node) {
     }
 }
 
+// Follows a variable to whatever its other end was linked to.
+// A variable that was never linked is a wire between two ports of the output.
+static inline Node resolve_var(NetVM* vm, Node node) {
+    while(NODE_IS_VAR(node)) {
+        Node val = atomic_load_explicit(&vm->var_buf[NODE_GET_VAR_IDX(node)], memory_order_relaxed);
+        if(val == node) {
+            break;
+        }
+        node = val;
+    }
+    return node;
+}
+
+// Reads back the net hanging from root once the VM is done reducing.
+// The tree is written in preorder, each CON, DUP and SWI followed by its aux ports.
+bool vm_readback(NetVM* vm, Node root, Readback* out) {
+    out->len = 0;
+    out->truncated = 0;
+    u64 cap = 64;
+    out->nodes = malloc(sizeof(ReadbackNode) * cap);
+    u64 stack_len = 0;
+    u64 stack_cap = 64;
+    Node* stack = malloc(sizeof(Node) * stack_cap);
+    if(out->nodes == NULL || stack == NULL) {
+        free(stack);
+        return false;
+    }
+
+    stack[stack_len++] = root;
+    while(stack_len > 0) {
+        if(out->len == vm->readback_nodes) {
+            out->truncated = 1;
+            break;
+        }
+        if(out->len == cap) {
+            cap *= 2;
+            ReadbackNode* nodes = realloc(out->nodes, sizeof(ReadbackNode) * cap);
+            if(nodes == NULL) {
+                free(stack);
+                return false;
+            }
+            out->nodes = nodes;
+        }
+
+        Node node = resolve_var(vm, stack[--stack_len]);
+        ReadbackNode* rb = &out->nodes[out->len++];
+        rb->kind = get_node_table_index(node);
+        rb->arity = 0;
+        rb->value = 0;
+
+        if(NODE_IS_CON(node) || NODE_IS_DUP(node) || NODE_IS_SWI(node)) {
+            Aux aux = node & U48_MASK;
+            u64 size = AUX_SIZE(aux);
+            Node* aux_nodes = get_aux(vm, aux);
+            rb->arity = size;
+            if(stack_len + size > stack_cap) {
+                stack_cap = (stack_len + size) * 2;
+                Node* grown = realloc(stack, sizeof(Node) * stack_cap);
+                if(grown == NULL) {
+                    free(stack);
+                    return false;
+                }
+                stack = grown;
+            }
+            // Reversed so the first port is read back first
+            for(u64 i = size; i > 0; i--) {
+                stack[stack_len++] = aux_nodes[i - 1];
+            }
+        } else if(NODE_IS_OPI(node)) {
+            rb->value = NODE_GET_OPI_OP(node);
+            rb->arity = NODE_GET_OPI_IDX(node);
+        } else if(NODE_IS_SYM(node)) {
+            rb->value = NODE_GET_SYM(node);
+        } else if(!NODE_IS_ERA(node) && !NODE_IS_NIL(node)) {
+            rb->value = node & U48_MASK;
+        }
+    }
+
+    free(stack);
+    return true;
+}
+
+void free_readback(Readback* readback) {
+    free(readback->nodes);
+    readback->nodes = NULL;
+    readback->len = 0;
+}
+
 // ====== VM ERRORS =========
 
-void vm_panic(NetVM* vm, ThreadMem* mem, const char* msg) {
-    fprintf(stderr, "VM FATAL ERROR: %s\n", msg);
-    fprintf(stderr, "THREAD ID: %d\n", mem->tid);
-    exit(-1);
+// A failing worker jumps straight out of thread_run, leaving the net half reduced.
+// The other workers stop at their next budget refill or once they run out of work,
+// and the next vm_reset throws the whole net away.
+_Noreturn void vm_fail(NetVM* vm, ThreadMem* mem, u32 code) {
+    u32 expected = VM_OK;
+    if(atomic_compare_exchange_strong_explicit(&vm->error, &expected, code, memory_order_relaxed, memory_order_relaxed)) {
+        vm->error_tid = mem->tid;
+    }
+    longjmp(mem->fail_jmp, 1);
+}
+
+// The error of the last run. Only meaningful once vm_run has returned.
+VMError vm_error(NetVM* vm) {
+    return (VMError){
+        .code = atomic_load_explicit(&vm->error, memory_order_relaxed),
+        .tid = vm->error_tid
+    };
+}
+
+// Takes between `need` and `want` units from one of the run's quotas, failing the run if fewer than `need` are left.
+// Returns how many were taken.
+static u64 take_quota(NetVM* vm, ThreadMem* mem, a64* quota, u64 need, u64 want, u32 code) {
+    u64 left = atomic_load_explicit(quota, memory_order_relaxed);
+    u64 take;
+    do {
+        if(left < need) {
+            vm_fail(vm, mem, code);
+        }
+        take = left < want ? left : want;
+    } while(!atomic_compare_exchange_weak_explicit(quota, &left, left - take, memory_order_relaxed, memory_order_relaxed));
+    return take;
+}
+
+// Gives the thread its next chunk of interactions.
+// Chunks shrink as the quota runs low so little of it is held by threads that won't use it.
+// Once it is used up the thread waits, since busy threads may still hand some back when they go idle.
+// The run only fails once every thread is idle or waiting.
+// Returns false if another thread failed and the run is being abandoned.
+static bool refill_budget(NetVM* vm, ThreadMem* mem) {
+    bool starved = false;
+    while(atomic_load_explicit(&vm->error, memory_order_relaxed) == VM_OK) {
+        u64 left = atomic_load_explicit(&vm->interaction_quota, memory_order_seq_cst);
+        if(left != 0) {
+            u64 take = left / vm->n_threads;
+            take = take > QUOTA_CHUNK ? QUOTA_CHUNK : take == 0 ? 1 : take;
+            if(atomic_compare_exchange_weak_explicit(&vm->interaction_quota, &left, left - take, memory_order_seq_cst, memory_order_relaxed)) {
+                if(starved) {
+                    atomic_fetch_sub_explicit(&vm->starved, 1, memory_order_seq_cst);
+                }
+                mem->budget = take;
+                return true;
+            }
+            continue;
+        }
+
+        if(!starved) {
+            atomic_fetch_add_explicit(&vm->starved, 1, memory_order_seq_cst);
+            starved = true;
+        }
+        // Idle threads hand back their budget before going idle, so the quota is checked again after seeing them
+        if(atomic_load_explicit(&vm->idle, memory_order_seq_cst) + atomic_load_explicit(&vm->starved, memory_order_seq_cst) == vm->n_threads
+            && atomic_load_explicit(&vm->interaction_quota, memory_order_seq_cst) == 0) {
+            vm_fail(vm, mem, VM_ERR_INTERACTION_LIMIT);
+        }
+        sched_yield();
+    }
+    if(starved) {
+        atomic_fetch_sub_explicit(&vm->starved, 1, memory_order_seq_cst);
+    }
+    return false;
+}
+
+// Hands the thread's unused interactions back, so threads that still have work can use them
+static void return_budget(NetVM* vm, ThreadMem* mem) {
+    if(mem->budget != 0) {
+        atomic_fetch_add_explicit(&vm->interaction_quota, mem->budget, memory_order_seq_cst);
+        mem->budget = 0;
+    }
 }
 
 // ====== RESOURCE MANIPULATION ========
 
+// Commits more of a thread's segment so every element below `needed` is usable.
+// Returns the new commit watermark of the segment.
+static u64 commit_segment(NetVM* vm, ThreadMem* mem, void* buf, u64 elem_size, u64 committed, u64 needed, u64 last) {
+    u64 target = commit_target(elem_size, needed, last);
+    if(!heap_commit((u8*)buf + committed * elem_size, (u8*)buf + target * elem_size)) {
+        vm_fail(vm, mem, VM_ERR_OUT_OF_MEMORY);
+    }
+    return target;
+}
+
+// Takes a chain of slots other threads freed into any thread's segment.
+// Used once a thread's own segment is full. Returns UINT64_MAX if every chain is empty.
+static u64 scavenge_remote(NetVM* vm, ThreadMem* mem, u64 head_offset) {
+    for(u32 i = 0; i < vm->n_threads; i++) {
+        ThreadMem* other = &vm->threads[(mem->tid + i) % vm->n_threads];
+        a64* head = (a64*)((u8*)other + head_offset);
+        if(atomic_load_explicit(head, memory_order_relaxed) != UINT64_MAX) {
+            u64 chain = atomic_exchange_explicit(head, UINT64_MAX, memory_order_acquire);
+            if(chain != UINT64_MAX) {
+                return chain;
+            }
+        }
+    }
+    return UINT64_MAX;
+}
+
+// Takes n contiguous windows from the thread's aux segment for slabs of a size, or runs if size is 0.
+// Returns the first node, or UINT64_MAX if the segment is full.
+static u64 take_windows(NetVM* vm, ThreadMem* mem, u64 n, u16 size) {
+    u64 begin = mem->aux_curr;
+    if(begin + n * SLAB_NODES > mem->aux_last) {
+        return UINT64_MAX;
+    }
+    take_quota(vm, mem, &vm->aux_quota, n * SLAB_NODES, n * SLAB_NODES, VM_ERR_AUX_LIMIT);
+    mem->aux_curr += n * SLAB_NODES;
+    if(mem->aux_curr > mem->aux_commit) {
+        u64 committed = mem->aux_commit;
+        mem->aux_commit = commit_segment(vm, mem, vm->aux_buf, sizeof(Node), mem->aux_commit, mem->aux_curr, mem->aux_last);
+        if(!heap_commit(&vm->aux_slabs[committed / SLAB_NODES], &vm->aux_slabs[mem->aux_commit / SLAB_NODES])) {
+            vm_fail(vm, mem, VM_ERR_OUT_OF_MEMORY);
+        }
+    }
+    for(u64 w = begin / SLAB_NODES; w < mem->aux_curr / SLAB_NODES; w++) {
+        vm->aux_slabs[w].size = size;
+    }
+    return begin;
+}
+
+static inline void link_slab(NetVM* vm, ThreadMem* mem, u32 window) {
+    AuxSlab* slab = &vm->aux_slabs[window];
+    u32* head = &mem->slab_partial[slab->size - 1];
+    slab->prev = SLAB_NONE;
+    slab->next = *head;
+    if(*head != SLAB_NONE) {
+        vm->aux_slabs[*head].prev = window;
+    }
+    *head = window;
+}
+
+static inline void unlink_slab(NetVM* vm, ThreadMem* mem, u32 window) {
+    AuxSlab* slab = &vm->aux_slabs[window];
+    if(slab->prev != SLAB_NONE) {
+        vm->aux_slabs[slab->prev].next = slab->next;
+    } else {
+        mem->slab_partial[slab->size - 1] = slab->next;
+    }
+    if(slab->next != SLAB_NONE) {
+        vm->aux_slabs[slab->next].prev = slab->prev;
+    }
+}
+
+// Sets up a slab for blocks of a size, reusing an emptied one if there is one.
+// Returns false if the segment is full.
+static bool new_slab(NetVM* vm, ThreadMem* mem, u64 size) {
+    u32 window = mem->slab_empty;
+    if(window != SLAB_NONE) {
+        mem->slab_empty = vm->aux_slabs[window].next;
+    } else {
+        u64 begin = take_windows(vm, mem, 1, size);
+        if(begin == UINT64_MAX) {
+            return false;
+        }
+        window = begin / SLAB_NODES;
+    }
+
+    AuxSlab* slab = &vm->aux_slabs[window];
+    u32 cap = SLAB_NODES / size;
+    slab->size = size;
+    slab->n_free = cap;
+    for(u32 i = 0; i < SLAB_NODES / 64; i++) {
+        u32 bits = cap > i * 64 ? cap - i * 64 : 0;
+        slab->free[i] = bits >= 64 ? UINT64_MAX : (1ull << bits) - 1;
+    }
+    link_slab(vm, mem, window);
+    return true;
+}
+
+// Takes the lowest free block of the first partial slab of a size
+static inline Aux slab_alloc(NetVM* vm, ThreadMem* mem, u64 size) {
+    u32 window = mem->slab_partial[size - 1];
+    AuxSlab* slab = &vm->aux_slabs[window];
+    u32 word = 0;
+    while(slab->free[word] == 0) {
+        word++;
+    }
+    u32 block = word * 64 + __builtin_ctzll(slab->free[word]);
+    slab->free[word] &= slab->free[word] - 1;
+    slab->n_free--;
+    if(slab->n_free == 0) {
+        unlink_slab(vm, mem, window);
+    }
+    return MAKE_AUX(size, (u64)window * SLAB_NODES + block * size);
+}
+
+// Returns a block to its slab, which must belong to this thread.
+// A slab that empties out is kept if it's the only one of its size, and set aside for reuse otherwise.
+static inline void slab_free(NetVM* vm, ThreadMem* mem, AuxSlab* slab, u64 begin) {
+    u32 window = begin / SLAB_NODES;
+    u32 block = (begin % SLAB_NODES) / slab->size;
+    slab->free[block / 64] |= 1ull << (block % 64);
+    slab->n_free++;
+    if(slab->n_free == 1) {
+        link_slab(vm, mem, window);
+    } else if(slab->n_free == SLAB_NODES / slab->size && (slab->next != SLAB_NONE || slab->prev != SLAB_NONE)) {
+        unlink_slab(vm, mem, window);
+        slab->next = mem->slab_empty;
+        mem->slab_empty = window;
+    }
+}
+
+// Returns a block of this thread's segment to its slab or free list
+static inline void free_own_aux(NetVM* vm, ThreadMem* mem, u64 size, u64 begin) {
+    AuxSlab* slab = &vm->aux_slabs[begin / SLAB_NODES];
+    if(slab->size != 0) {
+        slab_free(vm, mem, slab, begin);
+    } else {
+        vm->aux_buf[begin] = mem->aux_free[size - 1];
+        mem->aux_free[size - 1] = begin;
+    }
+}
+
+// Takes back the blocks of a size other threads freed into this thread's segment.
+// Returns whether there are any free blocks of that size now.
+bool reclaim_aux(NetVM* vm, ThreadMem* mem, u64 size) {
+    u64 block = atomic_exchange_explicit(&mem->remote_aux_free[size - 1], UINT64_MAX, memory_order_acquire);
+    while(block != UINT64_MAX) {
+        u64 next = vm->aux_buf[block];
+        free_own_aux(vm, mem, size, block);
+        block = next;
+    }
+    return mem->aux_free[size - 1] != UINT64_MAX || (size <= SLAB_MAX_SIZE && mem->slab_partial[size - 1] != SLAB_NONE);
+}
+
+// Bump allocates in the thread's run windows. Returns UINT64_MAX if the segment is full.
+static inline u64 bump_aux(NetVM* vm, ThreadMem* mem, u64 len) {
+    if(mem->aux_run_curr + len > mem->aux_run_end) {
+        u64 n = (len + SLAB_NODES - 1) / SLAB_NODES;
+        u64 begin = take_windows(vm, mem, n, 0);
+        if(begin == UINT64_MAX) {
+            return UINT64_MAX;
+        }
+        mem->aux_run_curr = begin;
+        mem->aux_run_end = begin + n * SLAB_NODES;
+    }
+    mem->aux_run_curr += len;
+    return mem->aux_run_curr - len;
+}
+
 // Allocates an aux block of a given size
 Aux alloc_aux(NetVM* vm, ThreadMem* mem, u64 size) {
-    if(mem->aux_free[size - 1] != UINT64_MAX) {
-        u64 block = mem->aux_free[size - 1];
-        mem->aux_free[size - 1] = vm->aux_buf[block];
-        return MAKE_AUX(size, block);
+    if(has_free_aux(vm, mem, size)) {
+        if(mem->aux_free[size - 1] != UINT64_MAX) {
+            u64 block = mem->aux_free[size - 1];
+            mem->aux_free[size - 1] = vm->aux_buf[block];
+            return MAKE_AUX(size, block);
+        }
+        return slab_alloc(vm, mem, size);
     }
 
-    mem->aux_curr += size;
-    if(mem->aux_curr > mem->aux_last) {
-        vm_panic(vm, mem, "AUX SPACE EXHAUSTED");
+    if(size <= SLAB_MAX_SIZE) {
+        if(new_slab(vm, mem, size)) {
+            return slab_alloc(vm, mem, size);
+        }
+    } else {
+        u64 block = bump_aux(vm, mem, size);
+        if(block != UINT64_MAX) {
+            return MAKE_AUX(size, block);
+        }
+    }
+
+    u64 block = scavenge_remote(vm, mem, offsetof(ThreadMem, remote_aux_free) + sizeof(a64) * (size - 1));
+    if(block == UINT64_MAX) {
+        vm_fail(vm, mem, VM_ERR_AUX_EXHAUSTED);
+    }
+    mem->aux_free[size - 1] = vm->aux_buf[block];
+    return MAKE_AUX(size, block);
+}
+
+// Allocates n blocks of the same size.
+// They come from slabs where possible, so they mostly end up next to each other.
+void alloc_aux_blocks(NetVM* vm, ThreadMem* mem, u64 size, u64 n, Aux* blocks) {
+    u64 i = 0;
+    if(size <= SLAB_MAX_SIZE) {
+        while(i < n) {
+            if(mem->slab_partial[size - 1] == SLAB_NONE && !new_slab(vm, mem, size)) {
+                break;
+            }
+            blocks[i++] = slab_alloc(vm, mem, size);
+        }
+    }
+    for(; i < n; i++) {
+        blocks[i] = alloc_aux(vm, mem, size);
     }
+}
 
-    return MAKE_AUX(size, mem->aux_curr - size);
+// Bump allocates `len` contiguous aux nodes, which may be split into blocks of any size.
+// Returns the index of the first node.
+u64 alloc_aux_run(NetVM* vm, ThreadMem* mem, u64 len) {
+    u64 begin = bump_aux(vm, mem, len);
+    if(begin == UINT64_MAX) {
+        // Freed blocks can't be put together into a run
+        vm_fail(vm, mem, VM_ERR_AUX_EXHAUSTED);
+    }
+    return begin;
 }
 
 Node* get_aux(NetVM* vm, Aux aux) {
     return &vm->aux_buf[AUX_BEGIN(aux)];
 }
 
+// Blocks are returned to the thread whose segment they're in.
+// If that's another thread, the block goes onto its remote list.
 void free_aux(NetVM* vm, ThreadMem* mem, Aux aux) {
     u64 size = AUX_SIZE(aux);
     u64 begin = AUX_BEGIN(aux);
-    vm->aux_buf[begin] = mem->aux_free[size - 1];
-    mem->aux_free[size - 1] = begin; 
+    if(begin - mem->tid * vm->aux_block_size < vm->aux_block_size) {
+        free_own_aux(vm, mem, size, begin);
+        return;
+    }
+
+    a64* head = &vm->threads[begin / vm->aux_block_size].remote_aux_free[size - 1];
+    u64 next = atomic_load_explicit(head, memory_order_relaxed);
+    do {
+        vm->aux_buf[begin] = next;
+    } while(!atomic_compare_exchange_weak_explicit(head, &next, begin, memory_order_release, memory_order_relaxed));
+    STAT(mem->remote_frees++);
+}
+
+// Lets the thread bump at least n more vars, taking them from the var quota a chunk at a time
+static void grow_vars(NetVM* vm, ThreadMem* mem, u64 n) {
+    u64 have = mem->var_end - mem->var_curr;
+    u64 room = mem->var_last - mem->var_end;
+    if(have + room < n) {
+        vm_fail(vm, mem, VM_ERR_VAR_EXHAUSTED);
+    }
+    u64 want = room < QUOTA_CHUNK ? room : QUOTA_CHUNK;
+    if(want < n - have) {
+        want = n - have;
+    }
+    u64 end = mem->var_end + take_quota(vm, mem, &vm->var_quota, n - have, want, VM_ERR_VAR_LIMIT);
+    if(end > mem->var_commit) {
+        mem->var_commit = commit_segment(vm, mem, vm->var_buf, sizeof(ANode), mem->var_commit, end, mem->var_last);
+    }
+    mem->var_end = end;
+}
+
+// Allocates n vars at once.
+// Whatever the free list can't cover is taken as one contiguous range of the segment.
+void alloc_vars(NetVM* vm, ThreadMem* mem, u64 n, u64* vars) {
+    u64 i = 0;
+    while(i < n && mem->var_free != UINT64_MAX) {
+        u64 var = mem->var_free;
+        mem->var_free = atomic_load_explicit(&vm->var_buf[var], memory_order_relaxed);
+        atomic_store_explicit(&vm->var_buf[var], NODE_VAR(var), memory_order_relaxed);
+        vars[i++] = var;
+    }
+    if(i < n && mem->var_last - mem->var_curr >= n - i) {
+        if(mem->var_end - mem->var_curr < n - i) {
+            grow_vars(vm, mem, n - i);
+        }
+        for(; i < n; i++) {
+            u64 var = mem->var_curr++;
+            atomic_store_explicit(&vm->var_buf[var], NODE_VAR(var), memory_order_relaxed);
+            vars[i] = var;
+        }
+    }
+    // Near the end of the segment, fall back to picking up remote frees one at a time
+    for(; i < n; i++) {
+        vars[i] = alloc_var(vm, mem);
+    }
 }
 
 u64 alloc_var(NetVM* vm, ThreadMem* mem) {
+    if(mem->var_free == UINT64_MAX && atomic_load_explicit(&mem->remote_var_free, memory_order_relaxed) != UINT64_MAX) {
+        mem->var_free = atomic_exchange_explicit(&mem->remote_var_free, UINT64_MAX, memory_order_acquire);
+    }
+    if(mem->var_curr == mem->var_last && mem->var_free == UINT64_MAX) {
+        mem->var_free = scavenge_remote(vm, mem, offsetof(ThreadMem, remote_var_free));
+    }
     if(mem->var_free != UINT64_MAX) {
         u64 var = mem->var_free;
         mem->var_free = atomic_load_explicit(&vm->var_buf[var], memory_order_relaxed);
         atomic_store_explicit(&vm->var_buf[var], NODE_VAR(var), memory_order_relaxed);
         return var;
     } 
-    if(mem->var_curr == mem->var_last) {
-        vm_panic(vm, mem, "VAR SPACE EXHAUSTED");
+    if(mem->var_curr == mem->var_end) {
+        grow_vars(vm, mem, 1);
     }
     mem->var_curr++;
     u64 var = mem->var_curr - 1;
@@ -144,62 +1071,254 @@ u64 alloc_var(NetVM* vm, ThreadMem* mem) {
 static inline bool is_priority_pair(Node n0, Node n1) {
     u8 n0_idx = get_node_table_index(n0);
     u8 n1_idx = get_node_table_index(n1);
-    const bool is_priority[10][10] = {
+    const bool is_priority[NODE_TABLE_SIZE][NODE_TABLE_SIZE] = {
         //           VAR    CAL    CON    DUP    ERA    OPI    OPO    SWI    SYM    NIL 
         /* VAR */ { true , true , true , true , true , true , true , true , true , true  },
-        /* CAL */ { true , false, false, false, false, false, false, false, false, true  },
-        /* CON */ { true , false, true , false, true , false, false, false, false, true  },
-        /* DUP */ { true , false, false, true , true , false, false, false, false, true  },
-        /* ERA */ { true , false, true , true , true , false, false, false, false, true  },
+        /* CAL */ { true , false, false, false, true , false, false, false, false, true  },
+        /* CON */ { true , false, true , false, true , false, false, false, true , true  },
+        /* DUP */ { true , false, false, true , true , false, false, false, true , true  },
+        /* ERA */ { true , true , true , true , true , false, false, true , false, true  },
         /* OPI */ { true , false, false, false, false, false, false, false, false, true  },
         /* OPO */ { true , false, false, false, false, false, false, false, false, true  },
-        /* SWI */ { true , false, false, false, false, false, false, false, false, true  },
-        /* SYM */ { true , false, false, false, false, false, false, false, false, true  },
+        /* SWI */ { true , false, false, false, true , false, false, false, true , true  },
+        /* SYM */ { true , false, true , true , false, false, false, true , false, true  },
         /* NIL */ { true , true , true , true , true , true , true , true , true , true  },
     };
     return is_priority[n0_idx][n1_idx];
 }
 
+// Moves the deque into a ring twice the size of the current one.
+// Rings that don't fit in the segment anymore are given address space of their own.
+static RedxRing* grow_redx(NetVM* vm, ThreadMem* mem, RedxRing* ring, i64 t, i64 b) {
+    if(mem->redx_n_rings == REDX_MAX_RINGS) {
+        vm_fail(vm, mem, VM_ERR_REDX_EXHAUSTED);
+    }
+    u64 cap = (ring->mask + 1) * 2;
+    u64 reserved = 0;
+    APair* buf = ring->buf + ring->mask + 1;
+    if(ring->reserved != 0 || buf + cap > mem->redx_base + vm->redx_block_size) {
+        reserved = sizeof(APair) * cap;
+        buf = heap_reserve(reserved);
+        if(buf == NULL) {
+            vm_fail(vm, mem, VM_ERR_REDX_EXHAUSTED);
+        }
+    }
+    if(!heap_commit(buf, buf + cap)) {
+        vm_fail(vm, mem, VM_ERR_OUT_OF_MEMORY);
+    }
+
+    RedxRing* next = &mem->redx_rings[mem->redx_n_rings];
+    next->buf = buf;
+    next->mask = cap - 1;
+    next->reserved = reserved;
+    mem->redx_n_rings++;
+    for(i64 i = t; i < b; i++) {
+        atomic_store_pair(&next->buf[i & next->mask], atomic_load_pair(&ring->buf[i & ring->mask]));
+    }
+    atomic_store_explicit(&mem->redx_ring, next, memory_order_release);
+    return next;
+}
+
+static inline void push_deque(NetVM* vm, ThreadMem* mem, Pair redex) {
+    i64 b = atomic_load_explicit(&mem->redx_bot, memory_order_relaxed);
+    i64 t = atomic_load_explicit(&mem->redx_top, memory_order_acquire);
+    RedxRing* ring = atomic_load_explicit(&mem->redx_ring, memory_order_relaxed);
+    if(b - t > (i64)ring->mask) {
+        ring = grow_redx(vm, mem, ring, t, b);
+    }
+    atomic_store_pair(&ring->buf[b & ring->mask], redex);
+    atomic_store_explicit(&mem->redx_bot, b + 1, memory_order_release);
+    STAT(mem->redx_pushes++);
+    STAT(mem->redx_peak = (u64)(b + 1 - t) > mem->redx_peak ? (u64)(b + 1 - t) : mem->redx_peak);
+}
+
+// Moves the oldest half of a full priority bag into the deque.
+// The newest redexes stay on top, so the thread keeps working on what it just produced.
+static void spill_prdx(NetVM* vm, ThreadMem* mem) {
+    u32 n = mem->prdx_put / 2;
+    for(u32 i = 0; i < n; i++) {
+        push_deque(vm, mem, mem->prdx[i]);
+    }
+    memmove(mem->prdx, mem->prdx + n, sizeof(Pair) * (mem->prdx_put - n));
+    mem->prdx_put -= n;
+}
+
 void push_redx(NetVM* vm, ThreadMem* mem, Node n0, Node n1) {
     if(is_priority_pair(n0, n1)) {
+        if(mem->prdx_put == THREAD_PRDX_SIZE) {
+            spill_prdx(vm, mem);
+        }
         mem->prdx[mem->prdx_put] = MAKE_PAIR(n0, n1);
         mem->prdx_put++;
+        STAT(mem->prdx_pushes++);
+        STAT(mem->prdx_peak = mem->prdx_put > mem->prdx_peak ? mem->prdx_put : mem->prdx_peak);
     } else {
-        atomic_store_pair(&mem->redx_base[mem->redx_put], MAKE_PAIR(n0, n1));
-        mem->redx_put++; 
+        push_deque(vm, mem, MAKE_PAIR(n0, n1));
     }
 }
 
-static inline Pair pop_redx(NetVM* vm, ThreadMem* mem) {
+// Pops a redex from the thread's own bags, priority bag first.
+// Returns false if both bags are empty.
+static inline bool pop_redx(ThreadMem* mem, Pair* redex) {
     if(mem->prdx_put > 0) {
         mem->prdx_put--;
-        return mem->prdx[mem->prdx_put];
-    } else if(mem->redx_put > 0) {
-        mem->redx_put--;
-        return atomic_load_pair(&mem->redx_base[mem->redx_put]); 
-    } else {
-        return MAKE_PAIR(NODE_NIL, NODE_NIL);
+        *redex = mem->prdx[mem->prdx_put];
+        return true;
+    }
+
+    i64 b = atomic_load_explicit(&mem->redx_bot, memory_order_relaxed) - 1;
+    atomic_store_explicit(&mem->redx_bot, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    i64 t = atomic_load_explicit(&mem->redx_top, memory_order_relaxed);
+
+    if(t > b) {
+        atomic_store_explicit(&mem->redx_bot, b + 1, memory_order_relaxed);
+        return false;
+    }
+
+    RedxRing* ring = atomic_load_explicit(&mem->redx_ring, memory_order_relaxed);
+    *redex = atomic_load_pair(&ring->buf[b & ring->mask]);
+    if(t == b) {
+        // Last redex in the bag, race the thieves for it
+        bool won = atomic_compare_exchange_strong_explicit(&mem->redx_top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&mem->redx_bot, b + 1, memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+// Steals the oldest redex from another thread's bag.
+// Old redexes tend to be close to the root of the net, so they carry the most work.
+static inline bool steal_redx(ThreadMem* victim, Pair* redex) {
+    i64 t = atomic_load_explicit(&victim->redx_top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    i64 b = atomic_load_explicit(&victim->redx_bot, memory_order_acquire);
+    if(t >= b) {
+        return false;
+    }
+    RedxRing* ring = atomic_load_explicit(&victim->redx_ring, memory_order_acquire);
+    *redex = atomic_load_pair(&ring->buf[t & ring->mask]);
+    return atomic_compare_exchange_strong_explicit(&victim->redx_top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+static inline bool try_steal(NetVM* vm, ThreadMem* mem, Pair* redex) {
+    mem->steal_seed ^= mem->steal_seed << 13;
+    mem->steal_seed ^= mem->steal_seed >> 7;
+    mem->steal_seed ^= mem->steal_seed << 17;
+    u32 start = mem->steal_seed % vm->n_threads;
+    for(u32 i = 0; i < vm->n_threads; i++) {
+        ThreadMem* victim = &vm->threads[(start + i) % vm->n_threads];
+        if(victim != mem && steal_redx(victim, redex)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline bool any_stealable(NetVM* vm) {
+    for(u32 tid = 0; tid < vm->n_threads; tid++) {
+        ThreadMem* victim = &vm->threads[tid];
+        i64 t = atomic_load_explicit(&victim->redx_top, memory_order_relaxed);
+        i64 b = atomic_load_explicit(&victim->redx_bot, memory_order_relaxed);
+        if(t < b) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Called once a thread's own bags are empty. Steals work from other threads, 
+// waiting for some to appear if there's none yet.
+// Returns false once every thread is out of work, meaning the net is fully reduced,
+// or once another thread has failed.
+// An idle thread never holds redexes: it leaves the idle count before stealing,
+// so all threads being idle at once implies every bag is empty.
+static bool find_redx(NetVM* vm, ThreadMem* mem, Pair* redex) {
+    if(try_steal(vm, mem, redex)) {
+        return true;
+    }
+
+    return_budget(vm, mem);
+    atomic_fetch_add_explicit(&vm->idle, 1, memory_order_seq_cst);
+    while(true) {
+        // A failed thread never goes idle, so the others give up once they see the error
+        if(atomic_load_explicit(&vm->idle, memory_order_seq_cst) == vm->n_threads
+            || atomic_load_explicit(&vm->error, memory_order_relaxed) != VM_OK) {
+            return false;
+        }
+        if(any_stealable(vm)) {
+            atomic_fetch_sub_explicit(&vm->idle, 1, memory_order_seq_cst);
+            if(try_steal(vm, mem, redex)) {
+                return true;
+            }
+            atomic_fetch_add_explicit(&vm->idle, 1, memory_order_seq_cst);
+        }
+        sched_yield();
+    }
+}
+
+// Erases a batch of nodes, skipping unlinked ports and nodes on which erasure is a no-op
+void erase_nodes(NetVM* vm, ThreadMem* mem, Node* nodes, u64 n) {
+    for(u64 i = 0; i < n; i++) {
+        if(NODE_IS_NIL(nodes[i])) {
+            continue;
+        }
+        if(NODE_IS_NULLARY(nodes[i])) {
+            mem->era_skipped++;
+        } else {
+            push_redx(vm, mem, NODE_ERA, nodes[i]);
+        }
     }
 }
 
 static inline void init_oper(NetVM* vm, ThreadMem* mem, u64 oper_idx, u64 op, u64 ins) {
     Operation* oper = &vm->oper_buf[oper_idx];
     oper->op = op;
-    oper->ins = alloc_aux(vm, mem, ins);
-    Node* ins_aux = get_aux(vm, oper->ins);
-    oper->killed = false;
+    oper->n_ins = ins;
+    if(ins > OPER_INLINE_INS) {
+        oper->ins_aux = alloc_aux(vm, mem, ins);
+    }
+    Node* inputs = oper_inputs(vm, oper);
+    for(u64 i = 0; i < ins; i++) {
+        inputs[i] = NODE_NIL;
+    }
+    oper->out = NODE_NIL;
     atomic_store_explicit(&oper->n_unlinked, ins + 1, memory_order_relaxed);
 }
 
+static void free_var(NetVM* vm, ThreadMem* mem, u64 var) {
+    if(var - mem->tid * vm->var_block_size < vm->var_block_size) {
+        atomic_store_explicit(&vm->var_buf[var], mem->var_free, memory_order_relaxed);
+        mem->var_free = var;
+        return;
+    }
+
+    a64* head = &vm->threads[var / vm->var_block_size].remote_var_free;
+    u64 next = atomic_load_explicit(head, memory_order_relaxed);
+    do {
+        atomic_store_explicit(&vm->var_buf[var], next, memory_order_relaxed);
+    } while(!atomic_compare_exchange_weak_explicit(head, &next, var, memory_order_release, memory_order_relaxed));
+    STAT(mem->remote_frees++);
+}
+
 u64 alloc_oper(NetVM* vm, ThreadMem* mem, u64 op, u64 ins) {
+    if(mem->oper_free == UINT64_MAX && atomic_load_explicit(&mem->remote_oper_free, memory_order_relaxed) != UINT64_MAX) {
+        mem->oper_free = atomic_exchange_explicit(&mem->remote_oper_free, UINT64_MAX, memory_order_acquire);
+    }
+    if(mem->oper_curr == mem->oper_last && mem->oper_free == UINT64_MAX) {
+        mem->oper_free = scavenge_remote(vm, mem, offsetof(ThreadMem, remote_oper_free));
+    }
     if(mem->oper_free != UINT64_MAX) {
         u64 oper_idx = mem->oper_free;
         mem->oper_free = vm->oper_buf[oper_idx].op;
         init_oper(vm, mem, oper_idx, op, ins);
         return oper_idx;
     }
-    if(mem->oper_curr == mem->oper_last) {
-        vm_panic(vm, mem, "OPERATION SPACE EXHAUSTED");
+    if(mem->oper_curr == mem->oper_commit) {
+        if(mem->oper_curr == mem->oper_last) {
+            vm_fail(vm, mem, VM_ERR_OPER_EXHAUSTED);
+        }
+        mem->oper_commit = commit_segment(vm, mem, vm->oper_buf, sizeof(Operation), mem->oper_commit, mem->oper_curr + 1, mem->oper_last);
     }
     mem->oper_curr++;
     u64 oper_idx = mem->oper_curr - 1;
@@ -209,8 +1328,74 @@ u64 alloc_oper(NetVM* vm, ThreadMem* mem, u64 op, u64 ins) {
 
 void free_oper(NetVM* vm, ThreadMem* mem, u64 oper) {
     Operation* op = &vm->oper_buf[oper];
-    op->op = mem->oper_free;
-    mem->oper_free = oper;
+    if(oper - mem->tid * vm->oper_block_size < vm->oper_block_size) {
+        op->op = mem->oper_free;
+        mem->oper_free = oper;
+        return;
+    }
+
+    a64* head = &vm->threads[oper / vm->oper_block_size].remote_oper_free;
+    u64 next = atomic_load_explicit(head, memory_order_relaxed);
+    do {
+        op->op = next;
+    } while(!atomic_compare_exchange_weak_explicit(head, &next, oper, memory_order_release, memory_order_relaxed));
+    STAT(mem->remote_frees++);
+}
+
+// Queues an operation whose ports are all linked
+static inline void ready_oper(NetVM* vm, ThreadMem* mem, u64 oper) {
+    mem->oper_ready[mem->oper_ready_len++] = oper;
+    if(mem->oper_ready_len == vm->oper_batch) {
+        flush_opers(vm, mem);
+    }
+}
+
+// Performs every queued operation. Returns false if there were none.
+bool flush_opers(NetVM* vm, ThreadMem* mem) {
+    if(mem->oper_ready_len == 0) {
+        return false;
+    }
+    u64 n = mem->oper_ready_len;
+    mem->oper_ready_len = 0;
+    #ifdef VM_STATS
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    #endif
+    perform_operations(vm, mem, mem->oper_ready, n);
+    #ifdef VM_STATS
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    mem->oper_nsec += (end.tv_sec - start.tv_sec) * 1000000000ull + end.tv_nsec - start.tv_nsec;
+    #endif
+    return true;
+}
+
+// Links a port of an operation. If the operation was killed in the meantime the node is erased instead.
+static inline void link_oper_port(NetVM* vm, ThreadMem* mem, Operation* op, Node* port, Node node) {
+    if(OPER_IS_KILLED(atomic_load_explicit(&op->n_unlinked, memory_order_relaxed))
+        || atomic_exchange_explicit((a64*)port, node, memory_order_acq_rel) == NODE_ERA) {
+        erase_nodes(vm, mem, &node, 1);
+    }
+}
+
+// Erases whatever got linked to an operation so far, then records the kill.
+// The slot itself has to wait for the ports that are still to come, they refer to it.
+// Each port is swapped for ERA, so a node linked to it concurrently finds ERA and erases itself.
+// The kill is recorded after the sweep, so once it's visible the ports are all ERA and later kills skip it.
+static inline void kill_oper(NetVM* vm, ThreadMem* mem, u64 oper) {
+    Operation* op = &vm->oper_buf[oper];
+    if(!OPER_IS_KILLED(atomic_load_explicit(&op->n_unlinked, memory_order_relaxed))) {
+        Node* ins = oper_inputs(vm, op);
+        for(u64 i = 0; i <= op->n_ins; i++) {
+            Node* port = i < op->n_ins ? &ins[i] : &op->out;
+            Node node = atomic_exchange_explicit((a64*)port, NODE_ERA, memory_order_acq_rel);
+            if(node != NODE_ERA) {
+                erase_nodes(vm, mem, &node, 1);
+            }
+        }
+    }
+    if((atomic_fetch_add_explicit(&op->n_unlinked, OPER_KILL - 1, memory_order_acq_rel) & OPER_UNLINKED_MASK) == 1) {
+        ready_oper(vm, mem, oper);
+    }
 }
 
 // ====== DEBUG =============
@@ -232,8 +1417,10 @@ void dump_thread_state(NetVM* vm, ThreadMem* mem) {
         printf(" ]\n");
     }
     printf("====== REDX ======\n");
-    for(i32 i = mem->redx_put - 1; i >= 0; i--) {
-        Pair redx = atomic_load_pair(&mem->redx_base[i]); 
+    i64 top = atomic_load_explicit(&mem->redx_top, memory_order_relaxed);
+    RedxRing* ring = atomic_load_explicit(&mem->redx_ring, memory_order_relaxed);
+    for(i64 i = atomic_load_explicit(&mem->redx_bot, memory_order_relaxed) - 1; i >= top; i--) {
+        Pair redx = atomic_load_pair(&ring->buf[i & ring->mask]); 
         printf("[ ");
         dump_node(redx.n0);
         printf(" ]\t[ ");
@@ -250,17 +1437,17 @@ void thread_run(NetVM* vm, ThreadMem* mem) {
     // The VM uses computed goto for its rule dispatch
     // The rule table fits in very nicely with the label lookup
     // Not sure if this makes a big difference for performance, but I couldn't resist
-    const void* dispatch_table[10][10] = {
+    const void* dispatch_table[NODE_TABLE_SIZE][NODE_TABLE_SIZE] = {
         //             VAR        CAL        CON        DUP        ERA        OPI        OPO        SWI        SYM        NIL 
         /* VAR */ { &&do_link, &&do_link, &&do_link, &&do_link, &&do_link, &&do_link, &&do_outl, &&do_link, &&do_link, &&do_halt },
-        /* CAL */ { &&do_link, &&do_void, &&do_void, &&do_void, &&do_void, &&do_inpl, &&do_outl, &&do_void, &&do_void, &&do_halt },
-        /* CON */ { &&do_link, &&do_void, &&do_anni, &&do_comm, &&do_eras, &&do_inpl, &&do_outl, &&do_void, &&do_void, &&do_halt },
-        /* DUP */ { &&do_link, &&do_void, &&do_comm, &&do_anni, &&do_eras, &&do_inpl, &&do_outl, &&do_void, &&do_void, &&do_halt },
-        /* ERA */ { &&do_link, &&do_void, &&do_eras, &&do_eras, &&do_void, &&do_kili, &&do_kilo, &&do_void, &&do_void, &&do_halt },
-        /* OPI */ { &&do_link, &&do_inpl, &&do_inpl, &&do_inpl, &&do_kili, &&do_halt, &&do_outl, &&do_inpl, &&do_inpl, &&do_halt },
+        /* CAL */ { &&do_link, &&do_call, &&do_call, &&do_call, &&do_void, &&do_call, &&do_outl, &&do_call, &&do_call, &&do_halt },
+        /* CON */ { &&do_link, &&do_call, &&do_anni, &&do_comm, &&do_eras, &&do_inpl, &&do_outl, &&do_void, &&do_eras, &&do_halt },
+        /* DUP */ { &&do_link, &&do_call, &&do_comm, &&do_anni, &&do_eras, &&do_inpl, &&do_outl, &&do_void, &&do_eras, &&do_halt },
+        /* ERA */ { &&do_link, &&do_void, &&do_eras, &&do_eras, &&do_void, &&do_kili, &&do_kilo, &&do_eras, &&do_void, &&do_halt },
+        /* OPI */ { &&do_link, &&do_call, &&do_inpl, &&do_inpl, &&do_kili, &&do_halt, &&do_outl, &&do_inpl, &&do_inpl, &&do_halt },
         /* OPO */ { &&do_outl, &&do_outl, &&do_outl, &&do_outl, &&do_kilo, &&do_outl, &&do_halt, &&do_outl, &&do_outl, &&do_halt },
-        /* SWI */ { &&do_link, &&do_void, &&do_void, &&do_void, &&do_void, &&do_inpl, &&do_outl, &&do_void, &&do_void, &&do_halt },
-        /* SYM */ { &&do_link, &&do_void, &&do_void, &&do_void, &&do_void, &&do_inpl, &&do_outl, &&do_void, &&do_void, &&do_halt },
+        /* SWI */ { &&do_link, &&do_call, &&do_void, &&do_void, &&do_eras, &&do_inpl, &&do_outl, &&do_void, &&do_swit, &&do_halt },
+        /* SYM */ { &&do_link, &&do_call, &&do_eras, &&do_eras, &&do_void, &&do_inpl, &&do_outl, &&do_swit, &&do_void, &&do_halt },
         /* NIL */ { &&do_halt, &&do_halt, &&do_halt, &&do_halt, &&do_halt, &&do_halt, &&do_halt, &&do_halt, &&do_halt, &&do_halt },
     };
 
@@ -268,20 +1455,21 @@ void thread_run(NetVM* vm, ThreadMem* mem) {
     u8 n0_idx;
     u8 n1_idx;
 
+    // Queued operations are flushed before looking for work on other threads,
+    // an idle thread must not be holding anything back
     #define DISPATCH() \
-        if(mem->redx_put == 0 && mem->prdx_put == 0) \
+        if(!pop_redx(mem, &redex) && \
+           !(flush_opers(vm, mem) && pop_redx(mem, &redex)) && \
+           !find_redx(vm, mem, &redex)) \
+            goto end; \
+        if(mem->budget == 0 && !refill_budget(vm, mem)) \
             goto end; \
-        redex = pop_redx(vm, mem); \
+        mem->budget--; \
         n0_idx = get_node_table_index(redex.n0); \
         n1_idx = get_node_table_index(redex.n1); \
-        atomic_fetch_add_explicit(&vm->interactions, 1, memory_order_relaxed); \
+        mem->interactions[n0_idx][n1_idx]++; \
         goto *dispatch_table[n0_idx][n1_idx]; 
 
-    #define ENSURE_REDX_SPACE(cnt) \
-        if(mem->redx_put > REDX_BLOCK_SIZE - cnt || mem->prdx_put > THREAD_PRDX_SIZE - cnt) { \
-            vm_panic(vm, mem, "REDEX SPACE EXHAUSTED"); \
-        }
-
     DISPATCH();
 
     u64 aux_size;
@@ -300,10 +1488,13 @@ void thread_run(NetVM* vm, ThreadMem* mem) {
     Operation* operation;
     Node* inputs;
 
+    Def* def;
+
     do_void:
+        STAT(mem->rule_counts[RULE_VOID]++);
         DISPATCH();
     do_link:
-        ENSURE_REDX_SPACE(1);
+        STAT(mem->rule_counts[RULE_LINK]++);
         Node var = redex.n0;
         Node val = redex.n1;
 
@@ -314,14 +1505,16 @@ void thread_run(NetVM* vm, ThreadMem* mem) {
         u64 var_idx = NODE_GET_VAR_IDX(var);
         Node var_node = NODE_VAR(var_idx);
 
-        if(!atomic_compare_exchange_strong_explicit(&vm->var_buf[var_idx], &var_node, val, memory_order_relaxed, memory_order_relaxed)) {
-            Node other_val = atomic_exchange_explicit(&vm->var_buf[var_idx], mem->var_free, memory_order_relaxed);
-            mem->var_free = var_idx;
-            push_redx(vm, mem, val, other_val);
+        // Acquire/release so the aux of a node handed over through a variable is visible to the thread that receives it.
+        // If the other end got here first the CAS fails, leaving its node in var_node, and the var is done with.
+        if(!atomic_compare_exchange_strong_explicit(&vm->var_buf[var_idx], &var_node, val, memory_order_acq_rel, memory_order_acquire)) {
+            free_var(vm, mem, var_idx);
+            push_redx(vm, mem, val, var_node);
         }
 
         DISPATCH();
-    do_anni: 
+    do_anni:
+        STAT(mem->rule_counts[RULE_ANNI]++);
         aux0 = redex.n0 & U48_MASK;
         aux1 = redex.n1 & U48_MASK;
 
@@ -330,11 +1523,13 @@ void thread_run(NetVM* vm, ThreadMem* mem) {
         #ifdef DEBUG_MODE
         aux1_size = AUX_SIZE(aux1);
         if(aux_size != aux1_size) {
-            vm_panic(vm, mem, "ANNIHILATION AUX SIZES ARE NOT THE SAME");
+            vm_fail(vm, mem, VM_ERR_INVALID_NET);
         }
         #endif
 
-        ENSURE_REDX_SPACE(aux_size);
+        if(aux_size == 2) {
+            goto do_anni2;
+        }
 
         aux0_nodes = get_aux(vm, aux0); 
         aux1_nodes = get_aux(vm, aux1); 
@@ -346,55 +1541,104 @@ void thread_run(NetVM* vm, ThreadMem* mem) {
         free_aux(vm, mem, aux0);
         free_aux(vm, mem, aux1);
 
+        DISPATCH();
+    do_anni2:
+        aux0_nodes = get_aux(vm, aux0); 
+        aux1_nodes = get_aux(vm, aux1); 
+
+        push_redx(vm, mem, aux0_nodes[0], aux1_nodes[0]);
+        push_redx(vm, mem, aux0_nodes[1], aux1_nodes[1]);
+
+        free_aux(vm, mem, aux0);
+        free_aux(vm, mem, aux1);
+
         DISPATCH();
     do_comm:
+        STAT(mem->rule_counts[RULE_COMM]++);
         aux0 = redex.n0 & U48_MASK;
         aux0_size = AUX_SIZE(aux0);
 
         aux1 = redex.n1 & U48_MASK;
         aux1_size = AUX_SIZE(aux1);
 
-        ENSURE_REDX_SPACE(aux0_size + aux1_size);
+        u64 n0_mask = redex.n0 & NODE_TAG_MASK;
+        u64 n1_mask = redex.n1 & NODE_TAG_MASK;
+
+        if(aux0_size == 2 && aux1_size == 2) {
+            goto do_comm2;
+        }
 
         aux0_nodes = get_aux(vm, aux0);
         aux1_nodes = get_aux(vm, aux1);
 
-        u64 n0_mask = redex.n0 & NODE_TAG_MASK;
-        u64 n1_mask = redex.n1 & NODE_TAG_MASK;
-
-        u64 vars[256][256];
+        // Both sides are wired up before anything is pushed,
+        // once a block is in a redex another thread may already be rewriting it
+        Aux blocks0[256];
+        Aux blocks1[256];
+        alloc_aux_blocks(vm, mem, aux1_size, aux0_size, blocks0);
+        alloc_aux_blocks(vm, mem, aux0_size, aux1_size, blocks1);
         for(u64 i = 0; i < aux0_size; i++) {
+            aux_nodes = get_aux(vm, blocks0[i]);
             for(u64 j = 0; j < aux1_size; j++) {
-                vars[i][j] = alloc_var(vm, mem);
+                Node v = NODE_VAR(alloc_var(vm, mem));
+                aux_nodes[j] = v;
+                get_aux(vm, blocks1[j])[i] = v;
             }
         }
 
         for(u64 i = 0; i < aux0_size; i++) {
-            aux = alloc_aux(vm, mem, aux1_size);
-            aux_nodes = get_aux(vm, aux);
-            for(u64 j = 0; j < aux1_size; j++) {
-                aux_nodes[j] = NODE_VAR(vars[i][j]);
-            }
-            Node n = n1_mask | aux;
-            push_redx(vm, mem, n, aux0_nodes[i]);
+            push_redx(vm, mem, n1_mask | blocks0[i], aux0_nodes[i]);
         }
-
         for(u64 i = 0; i < aux1_size; i++) {
-            aux = alloc_aux(vm, mem, aux0_size);
-            aux_nodes = get_aux(vm, aux);
-            for(u64 j = 0; j < aux0_size; j++) {
-                aux_nodes[j] = NODE_VAR(vars[j][i]);
-            }
-            Node n = n0_mask | aux;
-            push_redx(vm, mem, n, aux1_nodes[i]);
+            push_redx(vm, mem, n0_mask | blocks1[i], aux1_nodes[i]);
         }
 
         free_aux(vm, mem, aux0);
         free_aux(vm, mem, aux1);
 
+        DISPATCH();
+    do_comm2:
+        aux0_nodes = get_aux(vm, aux0);
+        aux1_nodes = get_aux(vm, aux1);
+
+        u64 vars2[4];
+        Aux blocks2[4];
+        alloc_vars(vm, mem, 4, vars2);
+        alloc_aux_blocks(vm, mem, 2, 4, blocks2);
+
+        Node v00 = NODE_VAR(vars2[0]);
+        Node v01 = NODE_VAR(vars2[1]);
+        Node v10 = NODE_VAR(vars2[2]);
+        Node v11 = NODE_VAR(vars2[3]);
+
+        aux_nodes = get_aux(vm, blocks2[0]);
+        aux_nodes[0] = v00;
+        aux_nodes[1] = v01;
+        aux_nodes = get_aux(vm, blocks2[1]);
+        aux_nodes[0] = v10;
+        aux_nodes[1] = v11;
+        aux_nodes = get_aux(vm, blocks2[2]);
+        aux_nodes[0] = v00;
+        aux_nodes[1] = v10;
+        aux_nodes = get_aux(vm, blocks2[3]);
+        aux_nodes[0] = v01;
+        aux_nodes[1] = v11;
+
+        push_redx(vm, mem, n1_mask | blocks2[0], aux0_nodes[0]);
+        push_redx(vm, mem, n1_mask | blocks2[1], aux0_nodes[1]);
+        push_redx(vm, mem, n0_mask | blocks2[2], aux1_nodes[0]);
+        push_redx(vm, mem, n0_mask | blocks2[3], aux1_nodes[1]);
+
+        free_aux(vm, mem, aux0);
+        free_aux(vm, mem, aux1);
+
         DISPATCH();
     do_eras:
-        if(NODE_IS_ERA(redex.n0)) {
+        STAT(mem->rule_counts[RULE_ERAS]++);
+        // An eraser or a number meeting a node with aux ports is copied into each of them.
+        // Numbers have no ports of their own, so a DUP can share one between a switch and
+        // the branch it picks the same way it shares an eraser.
+        if(NODE_IS_ERA(redex.n0) || NODE_IS_SYM(redex.n0)) {
             swap_nodes(&redex.n0, &redex.n1);
         }
 
@@ -403,55 +1647,112 @@ void thread_run(NetVM* vm, ThreadMem* mem) {
         aux_size = AUX_SIZE(aux);
         aux_nodes = get_aux(vm, aux);
 
-        ENSURE_REDX_SPACE(aux_size);
+        if(aux_size == 2) {
+            goto do_eras2;
+        }
 
         for(u64 i = 0; i < aux_size; i++) {
-            push_redx(vm, mem, aux_nodes[i], NODE_ERA);
+            if(NODE_IS_NULLARY(aux_nodes[i])) {
+                mem->era_skipped++;
+            } else {
+                push_redx(vm, mem, aux_nodes[i], redex.n1);
+            }
         }
 
         free_aux(vm, mem, aux);
 
+        DISPATCH();
+    do_eras2:
+        if(NODE_IS_NULLARY(aux_nodes[0])) {
+            mem->era_skipped++;
+        } else {
+            push_redx(vm, mem, aux_nodes[0], redex.n1);
+        }
+        if(NODE_IS_NULLARY(aux_nodes[1])) {
+            mem->era_skipped++;
+        } else {
+            push_redx(vm, mem, aux_nodes[1], redex.n1);
+        }
+
+        free_aux(vm, mem, aux);
+
+        DISPATCH();
+    do_swit:
+        STAT(mem->rule_counts[RULE_SWIT]++);
+        if(!NODE_IS_SWI(redex.n0)) {
+            swap_nodes(&redex.n0, &redex.n1);
+        }
+
+        aux = NODE_GET_SWI_AUX(redex.n0);
+        aux_size = AUX_SIZE(aux);
+        // The first aux node is the output, the rest are the branches
+        if(aux_size < 2) {
+            vm_fail(vm, mem, VM_ERR_INVALID_NET);
+        }
+        aux_nodes = get_aux(vm, aux);
+
+        idx = 1 + switch_branch(redex.n1, aux_size - 1);
+        push_redx(vm, mem, aux_nodes[0], aux_nodes[idx]);
+        erase_nodes(vm, mem, &aux_nodes[1], idx - 1);
+        erase_nodes(vm, mem, &aux_nodes[idx + 1], aux_size - idx - 1);
+
+        free_aux(vm, mem, aux);
+
         DISPATCH();
     do_inpl:
+        STAT(mem->rule_counts[RULE_INPL]++);
         if(NODE_IS_OPI(redex.n1)) {
             swap_nodes(&redex.n0, &redex.n1);
         }
         op = NODE_GET_OPI_OP(redex.n0);
         idx = NODE_GET_OPI_IDX(redex.n0);
         operation = &vm->oper_buf[op];
-        inputs = get_aux(vm, operation->ins);
-        inputs[idx] = redex.n1;
-        if(atomic_fetch_sub_explicit(&operation->n_unlinked, 1, memory_order_relaxed) == 1) {
-            perform_operation(vm, mem, op);
+        inputs = oper_inputs(vm, operation);
+        link_oper_port(vm, mem, operation, &inputs[idx], redex.n1);
+        if((atomic_fetch_sub_explicit(&operation->n_unlinked, 1, memory_order_acq_rel) & OPER_UNLINKED_MASK) == 1) {
+            ready_oper(vm, mem, op);
         }
         DISPATCH();
     do_outl:
+        STAT(mem->rule_counts[RULE_OUTL]++);
         if(NODE_IS_OPO(redex.n1)) {
             swap_nodes(&redex.n0, &redex.n1);
         }
         op = NODE_GET_OPO_OP(redex.n0);
         operation = &vm->oper_buf[op];
-        inputs = get_aux(vm, operation->ins);
-        operation->out = redex.n1;
-        if(atomic_fetch_sub_explicit(&operation->n_unlinked, 1, memory_order_relaxed) == 1) {
-            perform_operation(vm, mem, op);
+        link_oper_port(vm, mem, operation, &operation->out, redex.n1);
+        if((atomic_fetch_sub_explicit(&operation->n_unlinked, 1, memory_order_acq_rel) & OPER_UNLINKED_MASK) == 1) {
+            ready_oper(vm, mem, op);
         }
         DISPATCH();
+    do_call:
+        STAT(mem->rule_counts[RULE_CALL]++);
+        // Definitions are only expanded once something other than a var or an eraser meets them,
+        // so erased calls cost nothing and recursion unfolds only as far as it's needed
+        if(!NODE_IS_CAL(redex.n0)) {
+            swap_nodes(&redex.n0, &redex.n1);
+        }
+        #ifdef DEBUG_MODE
+        if(NODE_GET_CAL_IDX(redex.n0) >= vm->book->defs_len) {
+            vm_fail(vm, mem, VM_ERR_INVALID_NET);
+        }
+        #endif
+        def = vm->book->defs[NODE_GET_CAL_IDX(redex.n0)];
+        push_redx(vm, mem, instance_def(vm, mem, def), redex.n1);
+        DISPATCH();
     do_kili:
+        STAT(mem->rule_counts[RULE_KILI]++);
         if(NODE_IS_OPI(redex.n1)) {
             swap_nodes(&redex.n0, &redex.n1);
         }
-        op = NODE_GET_OPI_OP(redex.n0);
-        operation = &vm->oper_buf[op];
-        operation->killed = true;
+        kill_oper(vm, mem, NODE_GET_OPI_OP(redex.n0));
         DISPATCH();
     do_kilo:
+        STAT(mem->rule_counts[RULE_KILO]++);
         if(NODE_IS_OPO(redex.n1)) {
             swap_nodes(&redex.n0, &redex.n1);
         }
-        op = NODE_GET_OPO_OP(redex.n0);
-        operation = &vm->oper_buf[op];
-        operation->killed = true;
+        kill_oper(vm, mem, NODE_GET_OPO_OP(redex.n0));
         DISPATCH();
     do_halt:
         return;
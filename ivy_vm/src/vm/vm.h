@@ -3,47 +3,291 @@
 #define VM_H
 
 #include "common.h"
+#include "heap.h"
 #include "node.h"
 #include "operation.h"
+#include <setjmp.h>
 
 #define DEBUG_MODE
 
+// Statistics that cost time in the interaction loop are only gathered when built with VM_STATS
+#ifdef VM_STATS
+#define STAT(x) x
+#else
+#define STAT(x)
+#endif
+
 #define THREAD_PRDX_SIZE (1ul << 16)
 
+// Number of node kinds the dispatch table distinguishes, NIL included
+#define NODE_TABLE_SIZE 10
+
+typedef enum {
+    PIN_NONE,
+    // Worker n runs on the n-th CPU the process is allowed to use
+    PIN_CORE,
+    // Worker n runs on any CPU of the (n mod nodes)-th NUMA node
+    PIN_NODE
+} PinMode;
+
+// Caps on what a single run may use, 0 means no cap.
+// Aux nodes are counted a window at a time and vars a chunk at a time, so runs are cut off
+// close to the cap rather than exactly at it. Interactions are counted exactly.
+typedef struct {
+    u64 max_interactions;
+    u64 max_aux;
+    u64 max_vars;
+} VMLimits;
+
+typedef struct {
+    u32 n_threads;
+    u32 pin;
+    // How many ready operations a thread collects before performing them together, 0 picks the default
+    u32 oper_batch;
+    VMLimits limits;
+    // How many nodes of the output are read back at most, 0 picks READBACK_MAX_NODES
+    u64 readback_nodes;
+} VMConfig;
+
+// Why a run failed
+typedef enum {
+    VM_OK,
+    VM_ERR_OUT_OF_MEMORY,
+    VM_ERR_AUX_EXHAUSTED,
+    VM_ERR_VAR_EXHAUSTED,
+    VM_ERR_REDX_EXHAUSTED,
+    VM_ERR_OPER_EXHAUSTED,
+    VM_ERR_INTERACTION_LIMIT,
+    VM_ERR_AUX_LIMIT,
+    VM_ERR_VAR_LIMIT,
+    VM_ERR_INVALID_NET,
+    // The book couldn't be built or compiled, see book_finalize
+    VM_ERR_BOOK,
+    // A worker thread couldn't be started
+    VM_ERR_THREAD
+} VMErrorCode;
+
+typedef struct {
+    u32 code;
+    // The thread that hit the error
+    u32 tid;
+} VMError;
+
+// Interactions and vars are handed to threads in chunks of this size, so the quotas are rarely touched
+#define QUOTA_CHUNK 4096
+
+#define OPER_BATCH_DEFAULT 256
+
+// Entry defs with at least this many redexes and aux nodes are instanced by all the workers together
+#define ENTRY_SPLIT_MIN (1ul << 14)
+
+typedef enum {
+    RULE_LINK,
+    RULE_CALL,
+    RULE_ANNI,
+    RULE_COMM,
+    RULE_ERAS,
+    RULE_VOID,
+    RULE_INPL,
+    RULE_OUTL,
+    RULE_SWIT,
+    RULE_KILI,
+    RULE_KILO,
+    RULE_COUNT
+} Rule;
+
+// Shared with Rust, see stats.rs
+typedef struct {
+    u64 interactions;
+    // How much of its segments the thread used, in nodes, vars and operations
+    u64 aux_peak;
+    u64 var_peak;
+    u64 oper_peak;
+    // Freed slots held by the thread once the run is over, a measure of fragmentation
+    u64 aux_free;
+    u64 var_free;
+    u64 oper_free;
+    // The following are only gathered with VM_STATS
+    u64 remote_frees;
+    u64 redx_pushes;
+    u64 prdx_pushes;
+    u64 redx_peak;
+    u64 prdx_peak;
+    f64 oper_time;
+} ThreadStats;
+
+typedef struct {
+    // Whether the VM was built with VM_STATS
+    u32 enabled;
+    u32 n_threads;
+    u64 interactions;
+    f64 time_taken;
+    // Bytes of VM memory the run had committed at its peak. Pages a reused VM kept committed
+    // from earlier runs are only counted if this run used them.
+    u64 peak_memory;
+    u64 era_skipped;
+    u64 oper_batched;
+    // Only gathered with VM_STATS
+    u64 rules[RULE_COUNT];
+    // One entry per thread, released with free_stats
+    ThreadStats* threads;
+} VMStats;
+
+// A node of the output net, see vm_readback. Shared with Rust, see term.rs.
+typedef struct {
+    // The number for SYM, the index for VAR, CAL, OPI and OPO
+    u64 value;
+    // The node's dispatch table index
+    u32 kind;
+    // How many nodes follow as aux ports for CON, DUP and SWI, the input index for OPI
+    u32 arity;
+} ReadbackNode;
+
+#define READBACK_MAX_NODES (1ul << 28)
+
+typedef struct {
+    // The output net as a tree in preorder, with variables resolved where they were linked
+    ReadbackNode* nodes;
+    u64 len;
+    // Set if the tree had more nodes than the VM reads back and was cut short
+    u32 truncated;
+} Readback;
+
+// The smallest capacity of a thread's redex deque
+#define REDX_RING_MIN_POW2 12
+#define REDX_MAX_RINGS 48
+
+typedef struct {
+    APair* buf;
+    u64    mask;
+    // Bytes of address space reserved for this ring alone, 0 if it lies in the thread's segment
+    u64    reserved;
+} RedxRing;
+
+// The aux buffer is handed out in windows of SLAB_NODES nodes.
+// A window is either a slab of same-size blocks or holds bump allocated runs and large blocks.
+// Slabs keep blocks of a size packed together and give out the lowest free block first,
+// so consecutive allocations land next to each other.
+#define SLAB_NODES    512
+#define SLAB_MAX_SIZE 32
+#define SLAB_NONE     UINT32_MAX
+
+typedef struct {
+    // Bit i is set if the i-th block of the slab is free
+    u64 free[SLAB_NODES / 64];
+    // Links of the owner's list of partially used slabs of this size
+    u32 next;
+    u32 prev;
+    u16 n_free;
+    // Block size of a slab, 0 for a window of runs
+    u16 size;
+} AuxSlab;
+
 typedef struct ThreadMem {
+    struct NetVM* vm;
     u32 tid;
     pthread_t thread;
 
     // The current position of the bump allocator in the VM's aux buffer
     u64 aux_curr;
+    // Nodes below this index are committed memory
+    u64 aux_commit;
     // The last node index in this thread's segment of the aux buffer
     u64 aux_last;
     // The first free aux blocks that belong to this thread.
-    // aux_free[n] is the first free aux of size n
+    // aux_free[n] is the first free aux of size n.
+    // Blocks from slabs are returned to their slab instead.
     u64 aux_free[256];
+    // Slabs with free blocks, by block size
+    u32 slab_partial[SLAB_MAX_SIZE];
+    // Slabs that were emptied, reused for any size before new windows are taken
+    u32 slab_empty;
+    // Runs and blocks too large for slabs are bump allocated in windows of their own
+    u64 aux_run_curr;
+    u64 aux_run_end;
 
     u64 var_curr; 
+    u64 var_commit;
+    // Vars are bumped up to here, the end of what was committed and taken from the var quota
+    u64 var_end;
     u64 var_last;
     u64 var_free;
 
+    // Work stealing deque over this thread's segment of the redex buffer (Chase-Lev).
+    // The owner pushes and pops at the bottom, other threads steal from the top.
+    // Indices only ever grow and are wrapped into the current ring buffer.
+    // A full ring is replaced by one twice its size, placed right after it in the segment.
+    // Once the segment is used up, further rings get address space of their own.
+    // Old rings stay valid until the end of the run since thieves may still be reading them.
     APair* redx_base;
-    u32    redx_put;
+    _Atomic(RedxRing*) redx_ring;
+    RedxRing redx_rings[REDX_MAX_RINGS];
+    u32      redx_n_rings;
+    _Alignas(64) ai64 redx_top;
+    _Alignas(64) ai64 redx_bot;
+
+    // State of the xorshift generator used to pick steal victims
+    u64 steal_seed;
 
     u64 oper_curr;
+    u64 oper_commit;
     u64 oper_last;
     u64 oper_free;
 
+    // Operations whose ports are all linked, waiting to be performed as a batch.
+    // The queue is flushed when full and before the thread looks for work elsewhere.
+    u64* oper_ready;
+    u64  oper_ready_len;
+    // Scratch space for sorting and evaluating a batch, 4 times the batch size
+    u64* oper_scratch;
+    // Operations that were evaluated in a batch sweep rather than one at a time
+    u64  oper_batched;
+
     // Priority redex bag.
     // If reductions that decrease the size of the net are not executed first,
     // there's a good chance the net will blow up in size. 
     // As an example, consider the turnstile in the case the CON-DUP redex is always
     // reduced first.
+    // The priority bag is private to its thread and is never stolen from.
+    // When it fills up, its oldest half is spilled into the deque where other threads can take it.
     Pair prdx[THREAD_PRDX_SIZE];
     u32  prdx_put;
 
+    // Erasures that were dropped instead of pushed because they would have been no-ops
+    u64 era_skipped;
+
+    #ifdef VM_STATS
+    u64 rule_counts[RULE_COUNT];
+    u64 redx_pushes;
+    u64 prdx_pushes;
+    u64 redx_peak;
+    u64 prdx_peak;
+    // Nanoseconds spent performing operations
+    u64 oper_nsec;
+    // Slots freed into other threads' segments
+    u64 remote_frees;
+    #endif
+
+    // Slots of this thread's segments freed by other threads, chained like the local free lists.
+    // Others push onto them with a CAS and the owner takes a whole chain once its own list runs dry.
+    // A thread that runs out of space may take chains from any thread.
+    _Alignas(64) a64 remote_aux_free[256];
+    a64 remote_var_free;
+    a64 remote_oper_free;
+
+    // Interactions the thread may perform before taking more from the VM's budget
+    u64 budget;
+    // Where the thread goes when it fails, see vm_fail
+    jmp_buf fail_jmp;
+
     // Temporary buffers needed for instancing a definition
     u64* instance_vars;
     u64* instance_oper;
+    Aux* instance_aux;
+
+    // Interactions performed by this thread, indexed like the dispatch table.
+    // Only the owner writes them, so they live on their own cache lines and are summed after the run.
+    _Alignas(64) u64 interactions[NODE_TABLE_SIZE][NODE_TABLE_SIZE];
 } ThreadMem;
 
 #define VM_MAX_AUX_POW2 30
@@ -55,46 +299,123 @@ typedef struct ThreadMem {
 #define VM_MAX_REDX   (1ul << VM_MAX_REDX_POW2)
 #define VM_MAX_OPER   (1ul << VM_MAX_OPER_POW2)
 
-#define N_THREADS_POW2 3
-#define N_THREADS (1 << N_THREADS_POW2)
+#define VM_MAX_THREADS 1024
 
-#define AUX_BLOCK_SIZE_POW2 (VM_MAX_AUX_POW2 - N_THREADS_POW2)
-#define AUX_BLOCK_SIZE (1ul << AUX_BLOCK_SIZE_POW2) 
+// The buffers are reserved up front but only committed as the threads' allocators reach them
+typedef struct NetVM {
+    Node*      aux_buf;
+    // One per window of the aux buffer, committed along with it
+    AuxSlab*   aux_slabs;
+    ANode*     var_buf;
+    APair*     redx_buf;
+    Operation* oper_buf;
 
-#define VAR_BLOCK_SIZE_POW2 (VM_MAX_VAR_POW2 - N_THREADS_POW2)
-#define VAR_BLOCK_SIZE (1ul << VAR_BLOCK_SIZE_POW2)
+    u32 n_threads;
+    u32 pin;
+    u32 oper_batch;
+    VMLimits limits;
+    u64 readback_nodes;
+    ThreadMem* threads;
 
-#define REDX_BLOCK_SIZE_POW2 (VM_MAX_REDX_POW2 - N_THREADS_POW2)
-#define REDX_BLOCK_SIZE (1ul << REDX_BLOCK_SIZE_POW2)
+    // The book CAL nodes refer to
+    struct Book* book;
 
-#define OPER_BLOCK_SIZE_POW2 (VM_MAX_OPER_POW2 - N_THREADS_POW2)
-#define OPER_BLOCK_SIZE (1ul << OPER_BLOCK_SIZE_POW2)
+    // Size of each thread's segment of the buffers.
+    // The redex segment is rounded down to a power of two so deque indices can be masked.
+    u64 aux_block_size;
+    u64 var_block_size;
+    u64 redx_block_size;
+    u64 oper_block_size;
 
-typedef struct NetVM {
-    Node  aux_buf[VM_MAX_AUX];
-    ANode var_buf[VM_MAX_VAR];
-    APair redx_buf[VM_MAX_REDX];
-    Operation oper_buf[VM_MAX_OPER];
+    // Worker threads are started by the first run and stay parked between runs.
+    // Each run bumps pool_gen to wake them and waits for pool_busy to drop back to 0.
+    pthread_mutex_t pool_lock;
+    pthread_cond_t  pool_wake;
+    pthread_cond_t  pool_done;
+    u64  pool_gen;
+    u32  pool_busy;
+    bool pool_started;
+    bool pool_stop;
 
-    ThreadMem threads[N_THREADS];
+    // Number of threads that found no work, neither locally nor by stealing.
+    // Once every thread is idle the net is in normal form.
+    _Alignas(64) a32 idle;
 
-    a64 interactions;
+    // Set by the first thread that fails, the others stop once they notice
+    _Alignas(64) a32 error;
+    u32 error_tid;
+    // What is left of this run's quotas
+    a64 interaction_quota;
+    // Threads waiting for interactions to be handed back to an empty quota
+    a32 starved;
+    a64 aux_quota;
+    a64 var_quota;
+
+    // A large entry def is instanced by the workers themselves at the start of the run, NULL if it was instanced up front.
+    // The entry tables map its vars, operations and aux blocks to those of the instance, see vm_set_book.
+    struct Def* entry_def;
+    u64  entry_out_var;
+    u64* entry_vars;
+    u64* entry_oper;
+    Aux* entry_aux;
+    // Workers done with each phase of instancing the entry def
+    _Alignas(64) a32 entry_arrived[2];
 } NetVM;
 
-void vm_init(NetVM* vm);
-void vm_run(NetVM* vm);
+bool vm_init(NetVM* vm, VMConfig* config);
+bool vm_run(NetVM* vm);
+void vm_reset(NetVM* vm);
+void vm_release(NetVM* vm);
+void vm_destroy(NetVM* vm);
 
 void thread_run(NetVM* vm, ThreadMem* mem);
 
+// Records the error unless another thread failed first, then unwinds the thread to its fail_jmp
+_Noreturn void vm_fail(NetVM* vm, ThreadMem* mem, u32 code);
+VMError vm_error(NetVM* vm);
+
+u64 vm_interactions(NetVM* vm);
+void vm_rule_interactions(NetVM* vm, u64 counts[NODE_TABLE_SIZE][NODE_TABLE_SIZE]);
+bool vm_collect_stats(NetVM* vm, VMStats* stats);
+void free_stats(VMStats* stats);
+bool vm_readback(NetVM* vm, Node root, Readback* out);
+void free_readback(Readback* readback);
+
+bool reclaim_aux(NetVM* vm, ThreadMem* mem, u64 size);
+
+// Whether alloc_aux can hand out a block of this size without taking more of the segment,
+// picking up blocks other threads freed if the thread has none of its own
+static inline bool has_free_aux(NetVM* vm, ThreadMem* mem, u64 size) {
+    if(mem->aux_free[size - 1] != UINT64_MAX) {
+        return true;
+    }
+    if(size <= SLAB_MAX_SIZE && mem->slab_partial[size - 1] != SLAB_NONE) {
+        return true;
+    }
+    if(atomic_load_explicit(&mem->remote_aux_free[size - 1], memory_order_relaxed) == UINT64_MAX) {
+        return false;
+    }
+    return reclaim_aux(vm, mem, size);
+}
+
 Aux alloc_aux(NetVM* vm, ThreadMem* mem, u64 size);
+void alloc_aux_blocks(NetVM* vm, ThreadMem* mem, u64 size, u64 n, Aux* blocks);
+u64 alloc_aux_run(NetVM* vm, ThreadMem* mem, u64 len);
 Node* get_aux(NetVM* vm, Aux aux);
 void free_aux(NetVM* vm, ThreadMem* mem, Aux aux);
 
+static inline Node* oper_inputs(NetVM* vm, Operation* op) {
+    return op->n_ins <= OPER_INLINE_INS ? op->ins : get_aux(vm, op->ins_aux);
+}
+
 u64 alloc_var(NetVM* vm, ThreadMem* mem);
+void alloc_vars(NetVM* vm, ThreadMem* mem, u64 n, u64* vars);
 
 void push_redx(NetVM* vm, ThreadMem* mem, Node n0, Node n1);
+void erase_nodes(NetVM* vm, ThreadMem* mem, Node* nodes, u64 n);
 
 u64 alloc_oper(NetVM* vm, ThreadMem* mem, u64 op, u64 ins);
 void free_oper(NetVM* vm, ThreadMem* mem, u64 oper);
+bool flush_opers(NetVM* vm, ThreadMem* mem);
 
 #endif
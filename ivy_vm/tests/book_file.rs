@@ -0,0 +1,178 @@
+mod common;
+
+use std::{fs, io, path::PathBuf};
+use ivy_vm::{book::{Book, DefID, Operation}, node::Node, term::Term};
+
+// Layout of the start of a book file, see book_file.c
+const VERSION_OFFSET: usize = 8;
+const DEF_TABLE_OFFSET: usize = 32;
+const DEF_OUT_OFFSET: usize = 8;
+const DEF_REDX_LEN_OFFSET: usize = 2 * 8;
+const DEF_OPER_LEN_OFFSET: usize = 4 * 8;
+const DEF_TMPL_AUX_LEN_OFFSET: usize = 5 * 8;
+const DEF_TMPL_N_AUX_OFFSET: usize = 6 * 8;
+const DEF_OPS_OFFSET: usize = 10 * 8;
+const DEF_INS_OFFSET: usize = 11 * 8;
+const DEF_TMPL_OFFSET: usize = 12 * 8;
+
+fn temp_path(name: &str) -> PathBuf {
+    std::env::temp_dir().join(format!("ivy_book_file_{}_{}.book", std::process::id(), name))
+}
+
+fn pow2_book(book: &mut Book, main: DefID) {
+    let sum = common::pow2_sum(book, 10);
+    let mut def = book.get_def(main);
+    let call = def.call(sum);
+    let out = def.add_operation(Operation::Add, vec![call]);
+    def.set_out(out);
+}
+
+// Saves the book built by `build` and returns the bytes of the file
+fn saved_bytes(name: &str, build: impl Fn(&mut Book, DefID)) -> Vec<u8> {
+    let path = temp_path(name);
+    let mut book = Book::new();
+    let main = book.add_def();
+    build(&mut book, main);
+    book.save(&path).expect("save failed");
+    let bytes = fs::read(&path).unwrap();
+    fs::remove_file(&path).unwrap();
+    bytes
+}
+
+// Writes the bytes out and tries to map them as a book
+fn load_bytes(name: &str, bytes: &[u8]) -> io::Result<Book> {
+    let path = temp_path(name);
+    fs::write(&path, bytes).unwrap();
+    let book = Book::load_mmap(&path);
+    fs::remove_file(&path).unwrap();
+    book
+}
+
+fn read_u64(bytes: &[u8], at: usize) -> u64 {
+    u64::from_le_bytes(bytes[at..at + 8].try_into().unwrap())
+}
+
+fn assert_invalid(result: io::Result<Book>) {
+    match result {
+        Ok(_) => panic!("a broken book file was loaded"),
+        Err(err) => assert_eq!(err.kind(), io::ErrorKind::InvalidData)
+    }
+}
+
+#[test]
+fn round_trip() {
+    let builds: [(&str, fn(&mut Book, DefID)); 2] = [
+        ("pow2", pow2_book),
+        ("rec", |book, main| common::apply_rec_sum(book, main, 100.0))
+    ];
+    for (name, build) in builds {
+        let mut plain = Book::new();
+        let main = plain.add_def();
+        build(&mut plain, main);
+        let expected = common::eval(plain, 2);
+
+        let bytes = saved_bytes(name, build);
+        let loaded = load_bytes(name, &bytes).expect("load failed");
+        assert_eq!(common::eval(loaded, 2), expected);
+
+        // Changing a mapped def copies it out of the file first
+        let mut loaded = load_bytes(name, &bytes).expect("load failed");
+        loaded.optimize();
+        assert_eq!(common::eval(loaded, 2), expected);
+    }
+}
+
+#[test]
+fn rejects_truncated_file() {
+    let bytes = saved_bytes("truncated", pow2_book);
+    assert_invalid(load_bytes("truncated", &bytes[..bytes.len() - 8]));
+    assert_invalid(load_bytes("truncated", &bytes[..16]));
+}
+
+#[test]
+fn rejects_bad_version() {
+    let mut bytes = saved_bytes("version", pow2_book);
+    bytes[VERSION_OFFSET] += 1;
+    assert_invalid(load_bytes("version", &bytes));
+}
+
+#[test]
+fn rejects_bad_magic() {
+    let mut bytes = saved_bytes("magic", pow2_book);
+    bytes[0] ^= 0xFF;
+    assert_invalid(load_bytes("magic", &bytes));
+}
+
+#[test]
+fn rejects_out_of_range_template() {
+    // The first node of the template is the var in the CON's aux block
+    let bytes = saved_bytes("template", |book, main| {
+        let mut def = book.get_def(main);
+        let (a, a_) = def.add_var();
+        let con = def.con(&[a, Node::era()]);
+        def.add_redex(a_, 5.0.into());
+        def.set_out(con);
+    });
+    assert_eq!(common::eval(load_bytes("template", &bytes).expect("load failed"), 1), Term::Con(vec![Term::Num(5.0), Term::Era]));
+
+    let tmpl = read_u64(&bytes, DEF_TABLE_OFFSET + DEF_TMPL_OFFSET) as usize;
+    let mut corrupt = bytes.clone();
+    corrupt[tmpl..tmpl + 8].copy_from_slice(&(read_u64(&bytes, tmpl) + 1000).to_le_bytes());
+    assert_invalid(load_bytes("template", &corrupt));
+}
+
+#[test]
+fn rejects_unknown_operation() {
+    let mut bytes = saved_bytes("operation", pow2_book);
+    let ops = u64::from_le_bytes(bytes[DEF_TABLE_OFFSET + DEF_OPS_OFFSET..][..8].try_into().unwrap()) as usize;
+    bytes[ops..ops + 8].copy_from_slice(&99u64.to_le_bytes());
+    assert_invalid(load_bytes("operation", &bytes));
+}
+
+#[test]
+fn rejects_too_few_inputs() {
+    let mut bytes = saved_bytes("inputs", |book, main| {
+        let mut def = book.get_def(main);
+        let diff = def.add_operation(Operation::Sub, vec![5.0.into(), 3.0.into()]);
+        def.set_out(diff);
+    });
+    let ins = read_u64(&bytes, DEF_TABLE_OFFSET + DEF_INS_OFFSET) as usize;
+    bytes[ins..ins + 4].copy_from_slice(&0u32.to_le_bytes());
+    assert_invalid(load_bytes("inputs", &bytes));
+}
+
+// A CON of both ends of a var. Its template is the CON's aux block, two vars, then the CON at the root.
+fn var_pair_book(book: &mut Book, main: DefID) {
+    let mut def = book.get_def(main);
+    let (a, a_) = def.add_var();
+    let con = def.con(&[a, a_]);
+    def.set_out(con);
+}
+
+fn table_entry(bytes: &[u8], field: usize) -> usize {
+    read_u64(bytes, DEF_TABLE_OFFSET + field) as usize
+}
+
+// A node that isn't relocated goes into the net as is, so it can't carry an index
+#[test]
+fn rejects_unrelocated_var() {
+    let bytes = saved_bytes("unrelocated", var_pair_book);
+    assert!(load_bytes("unrelocated", &bytes).is_ok());
+
+    let nodes_len = table_entry(&bytes, DEF_TMPL_AUX_LEN_OFFSET) + 2 * table_entry(&bytes, DEF_REDX_LEN_OFFSET) + 1;
+    let kinds = table_entry(&bytes, DEF_TMPL_OFFSET) + 8 * nodes_len
+        + 8 * table_entry(&bytes, DEF_TMPL_N_AUX_OFFSET) + 12 * table_entry(&bytes, DEF_OPER_LEN_OFFSET);
+    let mut corrupt = bytes.clone();
+    // RELOC_NONE in place of RELOC_VAR
+    corrupt[kinds] = 0;
+    assert_invalid(load_bytes("unrelocated", &corrupt));
+}
+
+// The def itself is checked too, it's what gets compiled again once the def is changed
+#[test]
+fn rejects_out_of_range_source() {
+    let mut bytes = saved_bytes("source", var_pair_book);
+    let var = read_u64(&bytes, table_entry(&bytes, DEF_TMPL_OFFSET));
+    bytes[DEF_TABLE_OFFSET + DEF_OUT_OFFSET..][..8].copy_from_slice(&(var + 1000).to_le_bytes());
+    assert_invalid(load_bytes("source", &bytes));
+}
@@ -0,0 +1,82 @@
+#![allow(dead_code)]
+
+use ivy_vm::{book::{Book, DefID, Operation}, node::Node, run_vm, term::Term, VmConfig};
+
+// Defs summing 2^depth ones, each level calling the one below twice
+pub fn pow2_sum(book: &mut Book, depth: u64) -> DefID {
+    let id = book.add_def();
+    if depth == 0 {
+        book.get_def(id).set_out(1.0.into());
+    } else {
+        let half = pow2_sum(book, depth - 1);
+        let mut def = book.get_def(id);
+        let a = def.call(half);
+        let b = def.call(half);
+        let sum = def.add_operation(Operation::Add, vec![a, b]);
+        def.set_out(sum);
+    }
+    id
+}
+
+// SUM = λn. n == 0 ? 0 : n + SUM(n - 1), as two mutually recursive defs
+pub fn rec_sum(book: &mut Book) -> DefID {
+    let sum = book.add_def();
+    let rec = book.add_def();
+    {
+        let mut def = book.get_def(sum);
+        let (n, n_) = def.add_var();
+        let (ret, ret_) = def.add_var();
+        let (n1, n1_) = def.add_var();
+        let (n2, n2_) = def.add_var();
+        let dup = def.dup(&[n1, n2]);
+        def.add_redex(n_, dup);
+        let zero = def.con(&[Node::era(), 0.0.into()]);
+        let step = def.call(rec);
+        let branch = def.switch(n1_, vec![zero, step]);
+        let app = def.con(&[n2_, ret_]);
+        def.add_redex(branch, app);
+        let out = def.con(&[n, ret]);
+        def.set_out(out);
+    }
+    {
+        let mut def = book.get_def(rec);
+        let (m, m_) = def.add_var();
+        let (res, res_) = def.add_var();
+        let (m1, m1_) = def.add_var();
+        let (m2, m2_) = def.add_var();
+        let dup = def.dup(&[m1, m2]);
+        def.add_redex(m_, dup);
+        let dec = def.add_operation(Operation::Add, vec![m1_, (-1.0).into()]);
+        let (r, r_) = def.add_var();
+        let app = def.con(&[dec, r]);
+        let call = def.call(sum);
+        def.add_redex(call, app);
+        let total = def.add_operation(Operation::Add, vec![m2_, r_]);
+        def.add_redex(res_, total);
+        let out = def.con(&[m, res]);
+        def.set_out(out);
+    }
+    sum
+}
+
+// Makes `main` apply rec_sum to n
+pub fn apply_rec_sum(book: &mut Book, main: DefID, n: f64) {
+    let sum = rec_sum(book);
+    let mut def = book.get_def(main);
+    let (res, res_) = def.add_var();
+    let app = def.con(&[n.into(), res]);
+    let call = def.call(sum);
+    def.add_redex(call, app);
+    def.set_out(res_);
+}
+
+pub fn config(threads: u32) -> VmConfig {
+    VmConfig { threads, ..VmConfig::default() }
+}
+
+// Runs a book and returns its complete output
+pub fn eval(book: Book, threads: u32) -> Term {
+    let output = run_vm(book, &config(threads)).expect("run failed");
+    assert!(output.complete);
+    output.output
+}
@@ -0,0 +1,100 @@
+mod common;
+
+use ivy_vm::{book::{Book, Operation}, error::{Resource, VmError}, run_vm, term::Term, Limits, Vm, VmConfig};
+
+fn pow2_book(depth: u64) -> Book {
+    let mut book = Book::new();
+    let main = book.add_def();
+    let sum = common::pow2_sum(&mut book, depth);
+    let mut def = book.get_def(main);
+    let call = def.call(sum);
+    let out = def.add_operation(Operation::Add, vec![call]);
+    def.set_out(out);
+    book
+}
+
+fn rec_book(n: f64) -> Book {
+    let mut book = Book::new();
+    let main = book.add_def();
+    common::apply_rec_sum(&mut book, main, n);
+    book
+}
+
+fn limited(threads: u32, limits: Limits) -> VmConfig {
+    VmConfig { limits, ..common::config(threads) }
+}
+
+fn assert_limit(result: Result<ivy_vm::RunOutput, VmError>, expected: Resource) {
+    match result {
+        Err(VmError::LimitExceeded { resource, .. }) => assert_eq!(resource, expected),
+        Err(err) => panic!("expected the {:?} limit, got {}", expected, err),
+        Ok(output) => panic!("expected the {:?} limit, got {:?}", expected, output.output)
+    }
+}
+
+// Interactions are counted exactly, a run needing one more than the limit fails
+#[test]
+fn interaction_limit() {
+    for threads in [1, 2] {
+        let needed = run_vm(pow2_book(12), &common::config(threads)).expect("run failed").stats.interactions;
+        let at_limit = limited(threads, Limits { max_interactions: needed, ..Limits::default() });
+        assert_eq!(run_vm(pow2_book(12), &at_limit).expect("run failed").output, Term::Num(4096.0));
+        let under_limit = limited(threads, Limits { max_interactions: needed - 1, ..Limits::default() });
+        assert_limit(run_vm(pow2_book(12), &under_limit), Resource::Interactions);
+    }
+}
+
+// A CON tree with 2^depth leaves, all of it live at once
+fn tree_book(depth: u32) -> Book {
+    let mut book = Book::new();
+    let main = book.add_def();
+    let mut def = book.get_def(main);
+    let mut level: Vec<_> = (0..1 << depth).map(|i| (i as f64).into()).collect();
+    while level.len() > 1 {
+        level = level.chunks(2).map(|pair| def.con(pair)).collect();
+    }
+    def.set_out(level.pop().unwrap());
+    book
+}
+
+#[test]
+fn aux_limit() {
+    for threads in [1, 2] {
+        let config = limited(threads, Limits { max_aux: 100000, ..Limits::default() });
+        assert!(run_vm(tree_book(12), &config).expect("run failed").complete);
+        assert_limit(run_vm(tree_book(16), &config), Resource::Aux);
+    }
+}
+
+#[test]
+fn var_limit() {
+    for threads in [1, 2] {
+        let config = limited(threads, Limits { max_vars: 10000, ..Limits::default() });
+        assert_limit(run_vm(rec_book(100000.0), &config), Resource::Vars);
+    }
+}
+
+// Memory kept committed by a bigger earlier run isn't counted again
+#[test]
+fn peak_memory_is_per_run() {
+    let mut vm = Vm::new(&common::config(1)).expect("failed to create the VM");
+    let small = vm.run(&tree_book(4)).expect("run failed").stats.peak_memory;
+    let big = vm.run(&tree_book(18)).expect("run failed").stats.peak_memory;
+    assert!(big > small);
+    assert_eq!(vm.run(&tree_book(4)).expect("run failed").stats.peak_memory, small);
+}
+
+// A failed run leaves the VM ready for the next one, with a fresh quota
+#[test]
+fn reuse_after_failure() {
+    let limits = Limits { max_interactions: 100000, max_aux: 100000, max_vars: 100000 };
+    let mut vm = Vm::new(&limited(2, limits)).expect("failed to create the VM");
+    let expected = vm.run(&pow2_book(10)).expect("run failed");
+    for _ in 0..3 {
+        assert_limit(vm.run(&rec_book(100000.0)), Resource::Interactions);
+        let output = vm.run(&pow2_book(10)).expect("run after a failure failed");
+        assert_eq!(output.output, expected.output);
+        assert_eq!(output.stats.interactions, expected.stats.interactions);
+        assert_eq!(vm.run(&rec_book(100.0)).expect("run after a failure failed").output, Term::Num(5050.0));
+    }
+}
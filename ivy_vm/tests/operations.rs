@@ -0,0 +1,83 @@
+mod common;
+
+use ivy_vm::{book::{Book, Operation}, node::Node, term::Term};
+
+fn compute(op: Operation, ins: Vec<Node>) -> Term {
+    let mut book = Book::new();
+    let main = book.add_def();
+    let mut def = book.get_def(main);
+    let out = def.add_operation(op, ins);
+    def.set_out(out);
+    common::eval(book, 1)
+}
+
+// Reductions start from their identity, so they're defined on no inputs at all
+#[test]
+fn empty_reductions() {
+    assert_eq!(compute(Operation::Add, vec![]), Term::Num(0.0));
+    assert_eq!(compute(Operation::Mul, vec![]), Term::Num(1.0));
+    assert_eq!(compute(Operation::Min, vec![]), Term::Num(f64::INFINITY));
+    assert_eq!(compute(Operation::Max, vec![]), Term::Num(f64::NEG_INFINITY));
+    assert_eq!(compute(Operation::Fma, vec![]), Term::Num(1.0));
+}
+
+#[test]
+fn single_inputs() {
+    assert_eq!(compute(Operation::Sub, vec![3.0.into()]), Term::Num(3.0));
+    assert_eq!(compute(Operation::Div, vec![3.0.into()]), Term::Num(3.0));
+    assert_eq!(compute(Operation::Xor, vec![Node::sym(6)]).as_sym(), Some(6));
+}
+
+#[test]
+#[should_panic(expected = "at least 1 inputs")]
+fn sub_needs_an_input() {
+    compute(Operation::Sub, vec![]);
+}
+
+#[test]
+#[should_panic(expected = "at least 2 inputs")]
+fn comparisons_need_two_inputs() {
+    compute(Operation::Lt, vec![1.0.into()]);
+}
+
+// Out = {v, w} where v is only reachable through an input of an operation whose output is erased
+// and w is another input of it that never arrives. One of the input and the eraser meets the operation
+// directly and the other through an annihilation, so one of the two ways links the input before the kill
+// whichever order the scheduler takes them in.
+fn killed_operation(erase_directly: bool) -> Term {
+    let mut book = Book::new();
+    let main = book.add_def();
+    let mut def = book.get_def(main);
+    let (v, v_) = def.add_var();
+    let (w, w_) = def.add_var();
+    let payload = def.con(&[v_, 5.0.into()]);
+    let (left, right) = if erase_directly {
+        let (late, late_) = def.add_var();
+        let sum = def.add_operation(Operation::Add, vec![late_, w_]);
+        def.add_redex(sum, Node::era());
+        (late, payload)
+    } else {
+        let sum = def.add_operation(Operation::Add, vec![payload, w_]);
+        (sum, Node::era())
+    };
+    let left = def.con(&[left, 0.0.into()]);
+    let right = def.con(&[right, 0.0.into()]);
+    def.add_redex(left, right);
+    let out = def.con(&[v, w]);
+    def.set_out(out);
+    common::eval(book, 1)
+}
+
+// Inputs linked before the kill are erased right away, not once every port has arrived
+#[test]
+fn killed_operations_erase_their_inputs() {
+    for erase_directly in [false, true] {
+        match killed_operation(erase_directly) {
+            Term::Con(ports) => {
+                assert_eq!(ports[0], Term::Era, "erase_directly = {}", erase_directly);
+                assert!(matches!(ports[1], Term::OpInput(_, 1)));
+            },
+            term => panic!("unexpected output {:?}", term)
+        }
+    }
+}
@@ -0,0 +1,146 @@
+mod common;
+
+use ivy_vm::{book::{Book, DefID, Operation, OptimizeStats}, node::Node, term::Term};
+
+// Runs the book built by `build` as is and optimized, checking both give the same output
+fn run_both(build: impl Fn(&mut Book, DefID)) -> (Term, OptimizeStats) {
+    let mut plain = Book::new();
+    let main = plain.add_def();
+    build(&mut plain, main);
+    let mut optimized = Book::new();
+    let main = optimized.add_def();
+    build(&mut optimized, main);
+    let stats = optimized.optimize();
+
+    let expected = common::eval(plain, 2);
+    assert_eq!(common::eval(optimized, 2), expected);
+    (expected, stats)
+}
+
+#[test]
+fn pow2_sum_folds_to_a_number() {
+    let (output, stats) = run_both(|book, main| {
+        let sum = common::pow2_sum(book, 10);
+        let mut def = book.get_def(main);
+        let call = def.call(sum);
+        let out = def.add_operation(Operation::Add, vec![call]);
+        def.set_out(out);
+    });
+    assert_eq!(output, Term::Num(1024.0));
+    // Both calls of each of the 10 levels and the one in main
+    assert_eq!(stats.calls_inlined, 21);
+    assert_eq!(stats.operations_folded, 11);
+    assert_eq!(stats.redexes_before, 21);
+    assert_eq!(stats.redexes_after, 0);
+}
+
+#[test]
+fn recursion_is_left_alone() {
+    let (output, stats) = run_both(|book, main| common::apply_rec_sum(book, main, 100.0));
+    assert_eq!(output, Term::Num(5050.0));
+    // Nothing in the recursion is known before the number arrives, only its vars are linked.
+    // What's left is n - 1 and the recursive call in REC, and the call in main.
+    assert_eq!(stats.calls_inlined, 0);
+    assert_eq!(stats.operations_folded, 0);
+    assert_eq!(stats.redexes_before, 11);
+    assert_eq!(stats.redexes_after, 3);
+    assert_eq!(stats.vars_after, 3);
+}
+
+#[test]
+fn erased_subnets_are_removed() {
+    let (output, stats) = run_both(|book, main| {
+        let part = common::pow2_sum(book, 2);
+        let mut def = book.get_def(main);
+        // A CON tree whose leaves and root are erased
+        let mut tree = Vec::new();
+        for _ in 0..8 {
+            let (a, a_) = def.add_var();
+            def.add_redex(a_, Node::era());
+            tree.push(a);
+        }
+        while tree.len() > 1 {
+            let r = tree.pop().unwrap();
+            let l = tree.pop().unwrap();
+            let con = def.con(&[l, r]);
+            tree.insert(0, con);
+        }
+        def.add_redex(tree.pop().unwrap(), Node::era());
+        // An operation whose output is erased, with a call among its inputs
+        let call = def.call(part);
+        let unused = def.add_operation(Operation::Mul, vec![call, 3.0.into()]);
+        def.add_redex(unused, Node::era());
+        def.set_out(3.0.into());
+    });
+    assert_eq!(output, Term::Num(3.0));
+    // The calls in both levels of pow2_sum and the one in main
+    assert_eq!(stats.calls_inlined, 5);
+    assert_eq!(stats.operations_folded, 3);
+    assert_eq!(stats.redexes_before, 16);
+    assert_eq!(stats.redexes_after, 0);
+    assert_eq!(stats.aux_after, 0);
+    assert_eq!(stats.vars_after, 0);
+}
+
+#[test]
+fn operations_on_inputs_are_kept() {
+    let (output, stats) = run_both(|book, main| {
+        // f = λx. x * 2 + (1 + 2)
+        let f = book.add_def();
+        {
+            let mut def = book.get_def(f);
+            let (x, x_) = def.add_var();
+            let double = def.add_operation(Operation::Mul, vec![x_, 2.0.into()]);
+            let three = def.add_operation(Operation::Add, vec![1.0.into(), 2.0.into()]);
+            let res = def.add_operation(Operation::Add, vec![double, three]);
+            let out = def.con(&[x, res]);
+            def.set_out(out);
+        }
+        let mut def = book.get_def(main);
+        let (r, r_) = def.add_var();
+        let app = def.con(&[5.0.into(), r]);
+        let call = def.call(f);
+        def.add_redex(call, app);
+        def.set_out(r_);
+    });
+    assert_eq!(output, Term::Num(13.0));
+    // 1 + 2 is folded and x is linked straight into the multiplication
+    assert_eq!(stats.calls_inlined, 0);
+    assert_eq!(stats.operations_folded, 1);
+    assert_eq!(stats.redexes_before, 7);
+    assert_eq!(stats.redexes_after, 4);
+    assert_eq!(stats.vars_after, 1);
+}
+
+#[test]
+fn switches_on_numbers_are_taken() {
+    let (output, stats) = run_both(|book, main| {
+        let part = common::pow2_sum(book, 3);
+        let mut def = book.get_def(main);
+        let one = def.add_operation(Operation::Add, vec![0.5.into(), 0.5.into()]);
+        let call = def.call(part);
+        let picked = def.switch(one, vec![2.0.into(), call]);
+        let out = def.add_operation(Operation::Add, vec![picked]);
+        def.set_out(out);
+    });
+    assert_eq!(output, Term::Num(8.0));
+    assert_eq!(stats.calls_inlined, 7);
+    assert_eq!(stats.operations_folded, 5);
+    assert_eq!(stats.redexes_after, 0);
+}
+
+// The VM never expands a call nothing interacts with, so neither does the optimizer
+#[test]
+fn unused_calls_are_kept() {
+    let (output, stats) = run_both(|book, main| {
+        let part = common::pow2_sum(book, 1);
+        let mut def = book.get_def(main);
+        let a = def.call(part);
+        let b = def.call(part);
+        let out = def.con(&[a, b]);
+        def.set_out(out);
+    });
+    assert!(matches!(output, Term::Con(ports) if ports.iter().all(|port| matches!(port, Term::Call(_)))));
+    assert_eq!(stats.calls_inlined, 2);
+    assert_eq!(stats.operations_folded, 1);
+}
@@ -0,0 +1,130 @@
+mod common;
+
+use ivy_vm::{book::{Book, Def, Operation}, node::Node, run_vm, term::Term, VmConfig};
+
+// Runs a book whose only def is built by `build`
+fn read_back(build: impl FnOnce(&mut Def)) -> Term {
+    let mut book = Book::new();
+    let main = book.add_def();
+    build(&mut book.get_def(main));
+    common::eval(book, 1)
+}
+
+#[test]
+fn numbers() {
+    assert_eq!(read_back(|def| def.set_out(3.5.into())), Term::Num(3.5));
+    assert_eq!(read_back(|def| def.set_out((-0.25).into())), Term::Num(-0.25));
+    let sym = read_back(|def| def.set_out(Node::sym(42)));
+    assert_eq!(sym.as_sym(), Some(42));
+}
+
+#[test]
+fn nested_trees() {
+    let term = read_back(|def| {
+        let inner = def.con(&[1.0.into(), 2.0.into()]);
+        let dup = def.dup(&[Node::era(), 3.0.into(), 4.0.into()]);
+        let out = def.con(&[inner, dup]);
+        def.set_out(out);
+    });
+    assert_eq!(term, Term::Con(vec![
+        Term::Con(vec![Term::Num(1.0), Term::Num(2.0)]),
+        Term::Dup(vec![Term::Era, Term::Num(3.0), Term::Num(4.0)])
+    ]));
+}
+
+// A var with both ends in the output shows up twice, one with an end nowhere else shows up once
+#[test]
+fn free_vars() {
+    let term = read_back(|def| {
+        let (a, a_) = def.add_var();
+        let (b, _) = def.add_var();
+        let out = def.con(&[a, b, a_]);
+        def.set_out(out);
+    });
+    match term {
+        Term::Con(ports) => match &ports[..] {
+            [Term::Var(a), Term::Var(b), Term::Var(a_)] => {
+                assert_eq!(a, a_);
+                assert_ne!(a, b);
+            },
+            _ => panic!("unexpected ports {:?}", ports)
+        },
+        term => panic!("unexpected output {:?}", term)
+    }
+}
+
+// Vars linked during the run are followed to whatever they were linked to
+#[test]
+fn linked_and_erased_ports() {
+    let term = read_back(|def| {
+        let (a, a_) = def.add_var();
+        let (b, b_) = def.add_var();
+        let (c, c_) = def.add_var();
+        def.add_redex(a_, Node::era());
+        let pair = def.con(&[5.0.into(), b_]);
+        let unpair = def.con(&[c_, Node::era()]);
+        def.add_redex(pair, unpair);
+        let out = def.con(&[a, b, c]);
+        def.set_out(out);
+    });
+    assert_eq!(term, Term::Con(vec![Term::Era, Term::Era, Term::Num(5.0)]));
+}
+
+// Nodes that never got to interact are read back as they are
+#[test]
+fn unreduced_nodes() {
+    let mut book = Book::new();
+    let main = book.add_def();
+    let other = book.add_def();
+    book.get_def(other).set_out(1.0.into());
+    {
+        let mut def = book.get_def(main);
+        let (x, x_) = def.add_var();
+        let (y, y_) = def.add_var();
+        let swi = def.switch(x_, vec![0.0.into(), 1.0.into()]);
+        let sum = def.add_operation(Operation::Add, vec![y_, 1.0.into()]);
+        let call = def.call(other);
+        let out = def.con(&[x, swi, y, sum, call]);
+        def.set_out(out);
+    }
+    match common::eval(book, 1) {
+        Term::Con(ports) => match &ports[..] {
+            [Term::Swi(swi), Term::Var(res), Term::OpInput(op_in, 0), Term::OpOutput(op_out), Term::Call(id)] => {
+                assert_eq!(swi, &vec![Term::Var(*res), Term::Num(0.0), Term::Num(1.0)]);
+                assert_eq!(op_in, op_out);
+                assert_eq!(*id, other);
+            },
+            _ => panic!("unexpected ports {:?}", ports)
+        },
+        term => panic!("unexpected output {:?}", term)
+    }
+}
+
+// Nodes past the limit are left out and show up as Nil
+#[test]
+fn truncated_output() {
+    let build = |book: &mut Book| {
+        let main = book.add_def();
+        let mut def = book.get_def(main);
+        let left = def.con(&[1.0.into(), 2.0.into()]);
+        let right = def.con(&[3.0.into(), 4.0.into()]);
+        let out = def.con(&[left, right]);
+        def.set_out(out);
+    };
+
+    let mut book = Book::new();
+    build(&mut book);
+    let config = VmConfig { readback_nodes: 7, ..common::config(1) };
+    let output = run_vm(book, &config).expect("run failed");
+    assert!(output.complete);
+
+    let mut book = Book::new();
+    build(&mut book);
+    let config = VmConfig { readback_nodes: 4, ..common::config(1) };
+    let output = run_vm(book, &config).expect("run failed");
+    assert!(!output.complete);
+    assert_eq!(output.output, Term::Con(vec![
+        Term::Con(vec![Term::Num(1.0), Term::Num(2.0)]),
+        Term::Nil
+    ]));
+}
@@ -0,0 +1,76 @@
+mod common;
+
+use ivy_vm::{book::Book, node::Node, term::Term};
+
+// Builds a def that switches on `value` between numbered branches and returns the branch it picked
+fn pick(value: f64, branches: usize) -> Term {
+    let mut book = Book::new();
+    let main = book.add_def();
+    let mut def = book.get_def(main);
+    let nodes = (0..branches).map(|i| (i as f64).into()).collect();
+    let out = def.switch(value.into(), nodes);
+    def.set_out(out);
+    common::eval(book, 1)
+}
+
+#[test]
+fn switch_picks_branch() {
+    assert_eq!(pick(0.0, 3), Term::Num(0.0));
+    assert_eq!(pick(1.5, 3), Term::Num(1.0));
+    assert_eq!(pick(2.0, 3), Term::Num(2.0));
+    // Anything out of range picks the last branch
+    assert_eq!(pick(7.0, 3), Term::Num(2.0));
+    assert_eq!(pick(-1.0, 3), Term::Num(2.0));
+    assert_eq!(pick(f64::NAN, 3), Term::Num(2.0));
+    assert_eq!(pick(5.0, 1), Term::Num(0.0));
+}
+
+#[test]
+fn switch_erases_other_branches() {
+    let mut book = Book::new();
+    let main = book.add_def();
+    let mut def = book.get_def(main);
+    let (a, a_) = def.add_var();
+    let (b, b_) = def.add_var();
+    let left = def.con(&[a, Node::era()]);
+    let right = def.con(&[b, Node::era()]);
+    let out = def.switch(1.0.into(), vec![left, right]);
+    let res = def.con(&[out, a_, b_]);
+    def.set_out(res);
+    // The picked branch is still wired to b, the other one was erased along with a
+    match common::eval(book, 1) {
+        Term::Con(ports) => match &ports[..] {
+            [Term::Con(picked), Term::Era, Term::Var(b)] => assert_eq!(picked, &vec![Term::Var(*b), Term::Era]),
+            _ => panic!("unexpected ports {:?}", ports)
+        },
+        term => panic!("unexpected output {:?}", term)
+    }
+}
+
+// A number meeting a CON or DUP is copied into each of its ports
+#[test]
+fn numbers_are_copied_through_aux_ports() {
+    for dup in [false, true] {
+        let mut book = Book::new();
+        let main = book.add_def();
+        let mut def = book.get_def(main);
+        let (a, a_) = def.add_var();
+        let (b, b_) = def.add_var();
+        let copier = if dup { def.dup(&[a, b]) } else { def.con(&[a, b]) };
+        def.add_redex(copier, 7.0.into());
+        let out = def.con(&[a_, b_]);
+        def.set_out(out);
+        assert_eq!(common::eval(book, 1), Term::Con(vec![Term::Num(7.0), Term::Num(7.0)]));
+    }
+}
+
+// The recursion shares n between the switch and the branch through a DUP
+#[test]
+fn recursion_shares_numbers() {
+    for threads in [1, 4] {
+        let mut book = Book::new();
+        let main = book.add_def();
+        common::apply_rec_sum(&mut book, main, 1000.0);
+        assert_eq!(common::eval(book, threads), Term::Num(500500.0));
+    }
+}